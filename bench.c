@@ -0,0 +1,366 @@
+// Microbenchmarks for the row and output primitives in row.c
+//
+//   quill_bench [-w] [-t pct] baseline
+//
+// Prints ns/op and bytes/op (the allocator bytes each op leaves behind, as
+// mem_size() counts them) for every primitive on each synthetic input, best
+// of BENCH_ROUNDS runs. With a baseline, fails if any primitive got slower or
+// holds on to more memory by more than pct percent (default 50). -w rewrites
+// the baseline.
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "row.h"
+
+#define BENCH_MIN_NS 100000000LL // keep each primitive running this long
+#define BENCH_ROUNDS 5           // the fastest round counts, to shed noise
+#define BENCH_MAX 64
+
+typedef struct BenchInput {
+  const char *name;
+  char *line;
+  int len;
+} bench_input;
+
+typedef struct BenchResult {
+  char name[64];
+  double ns_per_op;
+  double bytes_per_op;
+} bench_result;
+
+bench_result results[BENCH_MAX];
+int num_results = 0;
+
+long long clock_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Short source lines, lines that are mostly tabs, and one huge line
+void make_inputs(bench_input *in) {
+  int j;
+  in[0].name = "short";
+  in[0].line = strdup("  if (row->size > 0) { return row->chars; }");
+  in[0].len = strlen(in[0].line);
+
+  in[1].name = "tabs";
+  in[1].len = 120;
+  in[1].line = malloc(in[1].len + 1);
+  for (j = 0; j < in[1].len; j++) {
+    in[1].line[j] = j % 3 ? '\t' : 'x';
+  }
+  in[1].line[in[1].len] = '\0';
+
+  in[2].name = "1mb";
+  in[2].len = 1 << 20;
+  in[2].line = malloc(in[2].len + 1);
+  for (j = 0; j < in[2].len; j++) {
+    in[2].line[j] = j % 61 == 0 ? '\t' : 'a' + j % 26;
+  }
+  in[2].line[in[2].len] = '\0';
+}
+
+void record(const char *prim, bench_input *in, long long ns, long ops,
+            double bytes) {
+  char name[64];
+  snprintf(name, sizeof(name), "%s/%s", prim, in->name);
+  int j;
+  for (j = 0; j < num_results; j++) {
+    if (strcmp(results[j].name, name) == 0) {
+      break;
+    }
+  }
+  bench_result *r = &results[j];
+  if (j == num_results) {
+    num_results++;
+    strcpy(r->name, name);
+  } else if (r->ns_per_op <= (double)ns / ops) {
+    return;
+  }
+  r->ns_per_op = (double)ns / ops;
+  r->bytes_per_op = bytes / ops;
+}
+
+// Allocator bytes behind the rows of buf
+double mem_bytes(ebuffer *buf) {
+  return (double)buf->mem_chars + buf->mem_render;
+}
+
+// A buffer holding the input as a single row
+void one_row(ebuffer *buf, bench_input *in) {
+  memset(buf, 0, sizeof(*buf));
+  editor_append_row(buf, in->line, in->len);
+}
+
+void free_buffer(ebuffer *buf) {
+  editor_free_rows(buf);
+  free(buf->row);
+  free(buf->pos_tree);
+}
+
+void bench_update_row(bench_input *in) {
+  ebuffer buf;
+  one_row(&buf, in);
+  double before = mem_bytes(&buf);
+  long ops = 0;
+  long long start = clock_ns(), ns;
+  while ((ns = clock_ns() - start) < BENCH_MIN_NS) {
+    int j;
+    for (j = 0; j < 64; j++) {
+      editor_update_row(&buf, &buf.row[0]);
+    }
+    ops += 64;
+  }
+  record("editor_update_row", in, ns, ops, mem_bytes(&buf) - before);
+  free_buffer(&buf);
+}
+
+void bench_row_conversion(bench_input *in) {
+  ebuffer buf;
+  one_row(&buf, in);
+  long ops = 0, sink = 0;
+  long long start = clock_ns(), ns;
+  while ((ns = clock_ns() - start) < BENCH_MIN_NS) {
+    int j;
+    for (j = 0; j < 64; j++) {
+      sink += editor_row_conversion(&buf.row[0], buf.row[0].size);
+    }
+    ops += 64;
+  }
+  record("editor_row_conversion", in, ns, ops, 0);
+  free_buffer(&buf);
+  if (sink == 42) {
+    puts("");
+  }
+}
+
+// Types 64 characters into the middle of a fresh copy of the row, only the
+// inserts themselves are timed
+void bench_row_insert_char(bench_input *in) {
+  long ops = 0;
+  long long ns = 0;
+  double bytes = 0;
+  while (ns < BENCH_MIN_NS) {
+    ebuffer buf;
+    one_row(&buf, in);
+    double before = mem_bytes(&buf);
+    long long start = clock_ns();
+    int j;
+    for (j = 0; j < 64; j++) {
+      editor_row_insert_char(&buf, &buf.row[0], buf.row[0].size / 2, 'q');
+    }
+    ns += clock_ns() - start;
+    bytes += mem_bytes(&buf) - before;
+    ops += 64;
+    free_buffer(&buf);
+  }
+  record("editor_row_insert_char", in, ns, ops, bytes);
+}
+
+// Types a character at 64 cursors spread along a fresh copy of the row, all
+// in one pass
+void bench_row_insert_chars(bench_input *in) {
+  int at[64], j;
+  for (j = 0; j < 64; j++) {
+    at[j] = (long long)in->len * j / 64;
+  }
+  long ops = 0;
+  long long ns = 0;
+  double bytes = 0;
+  while (ns < BENCH_MIN_NS) {
+    ebuffer buf;
+    one_row(&buf, in);
+    double before = mem_bytes(&buf);
+    long long start = clock_ns();
+    editor_row_insert_chars(&buf, &buf.row[0], at, 64, 'q');
+    ns += clock_ns() - start;
+    bytes += mem_bytes(&buf) - before;
+    ops++;
+    free_buffer(&buf);
+  }
+  record("editor_row_insert_chars", in, ns, ops, bytes);
+}
+
+void bench_append_row(bench_input *in) {
+  long ops = 0;
+  long long ns = 0;
+  double bytes = 0;
+  int per = in->len > 4096 ? 16 : 4096;
+  while (ns < BENCH_MIN_NS) {
+    ebuffer buf;
+    memset(&buf, 0, sizeof(buf));
+    long long start = clock_ns();
+    int j;
+    for (j = 0; j < per; j++) {
+      editor_append_row(&buf, in->line, in->len);
+    }
+    ns += clock_ns() - start;
+    ops += per;
+    bytes += mem_bytes(&buf);
+    free_buffer(&buf);
+  }
+  record("editor_append_row", in, ns, ops, bytes);
+}
+
+void bench_abuf_append(bench_input *in) {
+  long ops = 0;
+  long long ns = 0;
+  double bytes = 0;
+  int per = in->len > 4096 ? 16 : 1024;
+  while (ns < BENCH_MIN_NS) {
+    append_buffer ab = ABUF_INIT;
+    long long start = clock_ns();
+    int j;
+    for (j = 0; j < per; j++) {
+      abuf_append(&ab, in->line, in->len);
+    }
+    ns += clock_ns() - start;
+    ops += per;
+    bytes += mem_size(ab.b);
+    abuf_free(&ab);
+  }
+  record("abuf_append", in, ns, ops, bytes);
+}
+
+// One op serialises a buffer of about 16 MB made of the input row
+void bench_rows_to_string(bench_input *in) {
+  ebuffer buf;
+  memset(&buf, 0, sizeof(buf));
+  int rows = (16 << 20) / (in->len + 1), j;
+  for (j = 0; j < rows; j++) {
+    editor_append_row(&buf, in->line, in->len);
+  }
+
+  long ops = 0;
+  long long ns = 0;
+  double bytes = 0;
+  int len = 0;
+  while (ns < BENCH_MIN_NS) {
+    long long start = clock_ns();
+    char *s = editor_rows_to_string(&buf, &len);
+    ns += clock_ns() - start;
+    bytes += mem_size(s);
+    free(s);
+    ops++;
+  }
+  record("editor_rows_to_string", in, ns, ops, bytes);
+  free_buffer(&buf);
+}
+
+// How much worse now is than then, in percent. Growing from nothing is as
+// bad as it gets.
+double worse_by(double then, double now) {
+  if (then <= 0) {
+    return now > 0.5 ? 1e9 : 0;
+  }
+  return (now - then) / then * 100;
+}
+
+// Returns the number of primitives that regressed past threshold percent in
+// time or memory
+int compare_baseline(const char *path, double threshold) {
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  char name[64];
+  double ns, bytes;
+  int failed = 0, j;
+  while (fscanf(fp, "%63s %lf %lf", name, &ns, &bytes) == 3) {
+    for (j = 0; j < num_results; j++) {
+      if (strcmp(results[j].name, name) != 0) {
+        continue;
+      }
+      double change = worse_by(ns, results[j].ns_per_op);
+      if (change > threshold) {
+        printf("REGRESSION %-28s %.1f -> %.1f ns/op (%+.0f%%)\n", name, ns,
+               results[j].ns_per_op, change);
+        failed++;
+      }
+      change = worse_by(bytes, results[j].bytes_per_op);
+      if (change > threshold) {
+        printf("REGRESSION %-28s %.0f -> %.0f bytes/op\n", name, bytes,
+               results[j].bytes_per_op);
+        failed++;
+      }
+    }
+  }
+  fclose(fp);
+  return failed;
+}
+
+int write_baseline(const char *path) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    perror(path);
+    return -1;
+  }
+  int j;
+  for (j = 0; j < num_results; j++) {
+    fprintf(fp, "%s %.1f %.0f\n", results[j].name, results[j].ns_per_op,
+            results[j].bytes_per_op);
+  }
+  fclose(fp);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int write = 0, opt;
+  double threshold = 50;
+  while ((opt = getopt(argc, argv, "wt:")) != -1) {
+    switch (opt) {
+    case 'w':
+      write = 1;
+      break;
+    case 't':
+      threshold = atof(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-w] [-t pct] [baseline]\n", argv[0]);
+      return 2;
+    }
+  }
+  const char *baseline = optind < argc ? argv[optind] : NULL;
+
+  bench_input in[3];
+  make_inputs(in);
+  int round, j;
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    for (j = 0; j < 3; j++) {
+      bench_update_row(&in[j]);
+      bench_row_conversion(&in[j]);
+      bench_row_insert_char(&in[j]);
+      bench_row_insert_chars(&in[j]);
+      bench_append_row(&in[j]);
+      bench_abuf_append(&in[j]);
+      bench_rows_to_string(&in[j]);
+    }
+  }
+  for (j = 0; j < 3; j++) {
+    free(in[j].line);
+  }
+  for (j = 0; j < num_results; j++) {
+    printf("%-28s %14.1f ns/op %12.0f bytes/op\n", results[j].name,
+           results[j].ns_per_op, results[j].bytes_per_op);
+  }
+
+  if (baseline == NULL) {
+    return 0;
+  }
+  if (write) {
+    return write_baseline(baseline) == 0 ? 0 : 1;
+  }
+  int failed = compare_baseline(baseline, threshold);
+  if (failed == 0) {
+    printf("no regressions beyond %.0f%% against %s\n", threshold, baseline);
+  }
+  return failed == 0 ? 0 : 1;
+}
@@ -4,36 +4,63 @@
 #define _BSD_SOURCE
 #define _GNU_SOURCE
 //comment
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <malloc.h>
+#include <poll.h>
+#include <pthread.h>
+#include <regex.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "row.h"
+
 // DEFINES//
 #define VERSION "1.O"
-#define TAB_STOP 8
 #define CTRL_KEY(k) ((k & 0x1f))
 #define BACKSPACE 127
+#define NO_KEY 0 // a sequence we don't know, or a client hanging up
+#define FRAME_BUDGET_MS 16         // at most one ingest-driven redraw per frame
+#define INGEST_CHUNK (1 << 20)     // bytes read from a source per read()
+#define INGEST_TICK_MAX (16 << 20) // bytes ingested before yielding to input
+#define REPLACE_MAX_THREADS 64
+#define REPLACE_MIN_ROWS 4096 // rows per thread before splitting is worth it
+#define MEM_EVICT_SLACK (1 << 20) // render regrowth tolerated between evictions
+#define INDEX_MAGIC "QUILLIX3"
+#define INDEX_MIN_SIZE (1 << 20) // smaller files aren't worth caching an index
+#define SERVER_MAX_CLIENTS 64
 
 // PROTOTYPES //
 void editor_set_status_message(const char *, ...);
+void editor_process_keypress(void);
+uint64_t frame_hash(const char *, int);
+void editor_multi_insert(int);
+void editor_clamp_cursors(void);
+void editor_index_repair(void);
 // DATA//
 
-// Editor row
-typedef struct EditorRow {
-  int size;     // 4 bytes
-  int rsize;    // 4 bytes
-  char *chars;  // 8 bytes
-  char *render; // 8 bytes
-} erow;
+// A position in the buffer, for cursors beyond the one at cx, cy
+typedef struct Cursor {
+  int cx, cy;
+} cursor;
 
 // Editor configuration
 typedef struct EditorConfig {
@@ -45,9 +72,37 @@ typedef struct EditorConfig {
                // column)
   int screen_rows; // 4 bytes, gives the amount
   int screen_cols; // 4 bytes
-  int num_rows;    // 4 bytes
-  erow *row;       // 8 bytes
+  ebuffer *buf;    // 8 bytes, the rows being edited
   char *file;      // 8 bytes for a file name
+  int src_fd;      // descriptor rows are still read from, -1 if none
+  off_t src_off;   // bytes of the file already turned into rows
+  int follow;      // 1 while tailing a growing file (read-only)
+  int streaming;   // 1 while src_fd is a pipe still being drained
+  int tty_fd;      // keyboard, /dev/tty when the buffer comes from stdin
+  int out_fd;      // where frames go, the terminal or a client's socket
+  int client;      // 1 if tty_fd and out_fd are a client attached to a server
+  int detached;    // 1 once that client has quit or hung up
+  int redraw;      // 1 if the screen no longer matches the buffer
+  long long last_refresh; // monotonic ms of the last frame
+  uint64_t *frame;   // hash of each screen line as the terminal shows it
+  int frame_row_off; // row_off the text lines in frame were drawn at
+  int sync_output;   // 1 if the terminal supports synchronized updates
+  size_t mem_frame;  // allocator bytes behind the last frame sent
+  size_t mem_budget; // evict derived data past this many bytes, 0 for none
+  size_t mem_render_floor; // mem_render right after the last eviction
+  int mem_status;    // 1 while the status bar shows memory use
+  char *mem_report;  // file full memory reports are appended to, or NULL
+  char *macro;     // recorded keystrokes
+  int macro_len;
+  int macro_cap;
+  int recording;   // 1 while keystrokes are being appended to macro
+  int replay_pos;  // next macro key to feed, -1 when not replaying
+  cursor *cursors; // extra cursors typing also goes to, in any order
+  int num_cursors;
+  int cursor_cap;
+  int block;       // 1 while a block is anchored, spanning to the cursor
+  int block_cy;    // row and render column of the block's anchor
+  int block_rx;
   char statusmsg[80];
   time_t statusmsg_time;
   struct termios orig_termios; // This is a low-level struct which gives us
@@ -58,6 +113,13 @@ econfig E;
 
 // TERMINAL//
 
+// Monotonic clock in milliseconds, used to pace redraws
+long long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 // Error handling, resets terminal state and kills Quill
 void die(const char *s) {
   write(STDOUT_FILENO, "\x1b[2J", 4);
@@ -69,14 +131,14 @@ void die(const char *s) {
 
 // Use to restore original terminal settings after closing Quill
 void disable_raw_mode(void) {
-  if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1) {
+  if (tcsetattr(E.tty_fd, TCSAFLUSH, &E.orig_termios) == -1) {
     die("tcsetattr");
   }
 }
 
 // Obtain original terminal settings
 void enable_raw_mode(void) {
-  if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1) {
+  if (tcgetattr(E.tty_fd, &E.orig_termios) == -1) {
     die("tcgetattr");
   }
   // Wether exiting through exit() or main(), ensures that terminal is restored
@@ -90,16 +152,29 @@ void enable_raw_mode(void) {
   raw.c_cc[VMIN] = 0;
   raw.c_cc[VTIME] = 1;
   // Uptading terminal to match new settings
-  if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
+  if (tcsetattr(E.tty_fd, TCSAFLUSH, &raw) == -1) {
     die("tcsetattr");
   }
 }
 
-// Reads in keystrokes
-char editor_read_key(void) {
+// 1 if a read that came back with nread found the client gone, which
+// detaches it. Prompts it was in unwind as on Escape.
+int editor_hung_up(int nread) {
+  if (E.client && (nread == 0 || (nread == -1 && errno != EAGAIN))) {
+    E.detached = 1;
+  }
+  return E.detached;
+}
+
+// Reads in keystrokes. Escape on its own is Escape, any other sequence not
+// known here is NO_KEY, so it can't be taken for one.
+char editor_read_terminal_key(void) {
   int nread;
   char c;
-  while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
+  while ((nread = read(E.tty_fd, &c, 1)) != 1) {
+    if (editor_hung_up(nread)) {
+      return NO_KEY;
+    }
     if ((nread == -1 && errno != EAGAIN)) {
       die("read");
     }
@@ -107,12 +182,26 @@ char editor_read_key(void) {
 
   if (c == '\x1b') {
     char seq[3];
-    if (read(STDIN_FILENO, &seq[0], 1) != 1 ||
-        read(STDIN_FILENO, &seq[1], 1) != 1) {
-      return '\x1b';
+    if ((nread = read(E.tty_fd, &seq[0], 1)) != 1) {
+      return editor_hung_up(nread) ? NO_KEY : '\x1b';
+    }
+    if (read(E.tty_fd, &seq[1], 1) != 1) {
+      return NO_KEY;
     }
 
-    if (seq[0] == '[') {
+    if (seq[0] == '[' && seq[1] >= '0' && seq[1] <= '9') {
+      // Page Up and Page Down are ESC [ 5 ~ and ESC [ 6 ~, read as the
+      // Ctrl-U and Ctrl-D that also page
+      if (read(E.tty_fd, &seq[2], 1) != 1 || seq[2] != '~') {
+        return NO_KEY;
+      }
+      switch (seq[1]) {
+      case '5':
+        return CTRL_KEY('u');
+      case '6':
+        return CTRL_KEY('d');
+      }
+    } else if (seq[0] == '[') {
       // Keystroke handling for movement
       switch (seq[1]) {
       case 'A':
@@ -126,12 +215,30 @@ char editor_read_key(void) {
       }
     }
 
-    return '\x1b';
+    return NO_KEY;
   } else {
     return c;
   }
 }
 
+// Next key from the macro being replayed, or from the terminal while
+// recording it. A macro that runs dry mid-prompt reads as Escape.
+char editor_read_key(void) {
+  if (E.replay_pos >= 0) {
+    return E.replay_pos < E.macro_len ? E.macro[E.replay_pos++] : '\x1b';
+  }
+
+  char c = editor_read_terminal_key();
+  if (E.recording) {
+    if (E.macro_len == E.macro_cap) {
+      E.macro_cap = E.macro_cap ? E.macro_cap * 2 : 64;
+      E.macro = realloc(E.macro, E.macro_cap);
+    }
+    E.macro[E.macro_len++] = c;
+  }
+  return c;
+}
+
 int get_cursor_position(int *rows, int *cols) {
   char buf[32];
   uint32_t i = 0;
@@ -140,7 +247,7 @@ int get_cursor_position(int *rows, int *cols) {
   }
 
   while (i < sizeof(buf) - 1) {
-    if (read(STDIN_FILENO, &buf[i], 1) != 1 || buf[i] == 'R') {
+    if (read(E.tty_fd, &buf[i], 1) != 1 || buf[i] == 'R') {
       break;
     }
     i++;
@@ -171,171 +278,731 @@ int get_window_size(int *rows, int *cols) {
   }
 }
 
-// ROW OPERATIONS//
+// Asks for DEC mode 2026 (synchronized output) with DECRQM. The DA1 query
+// after it is answered by every terminal, so we know when to stop waiting.
+int detect_sync_output(void) {
+  const char *query = "\x1b[?2026$p\x1b[c";
+  if (write(STDOUT_FILENO, query, strlen(query)) != (ssize_t)strlen(query)) {
+    return 0;
+  }
 
-int editor_row_conversion(erow *row, int cx) {
-  int rx = 0, j;
-  for (j = 0; j < cx; j++) {
-    if (row->chars[j] == '\t') {
-      rx += (TAB_STOP - 1) - (rx % TAB_STOP);
+  char buf[64];
+  size_t i = 0;
+  struct pollfd pfd = {E.tty_fd, POLLIN, 0};
+  while (i < sizeof(buf) - 1 && poll(&pfd, 1, 100) > 0) {
+    if (read(E.tty_fd, &buf[i], 1) != 1) {
+      break;
+    }
+    if (buf[i++] == 'c') {
+      break;
     }
-    rx++;
   }
-  return rx;
+  buf[i] = '\0';
+
+  // Reply is ESC [ ? 2026 ; Ps $ y, where Ps 1 or 2 means set or reset
+  char *reply = strstr(buf, "\x1b[?2026;");
+  return reply && (reply[8] == '1' || reply[8] == '2');
 }
-void editor_update_row(erow *row) {
-  int tabs = 0;
-  int j, idx = 0;
-  for (j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t') {
-      tabs++;
-    }
+
+// EDITOR OPERATIONS //
+
+// Returns 0 and says why when the buffer can't be modified right now
+int editor_writable(void) {
+  if (E.follow) {
+    editor_set_status_message("Read-only while following (Ctrl-F to stop)");
+    return 0;
+  }
+  if (E.streaming) {
+    editor_set_status_message("Read-only until input is fully read");
+    return 0;
+  }
+  return 1;
+}
+
+void editorInsertChar(int c) {
+  if (!editor_writable()) {
+    return;
+  }
+  if (E.num_cursors || E.block) {
+    editor_multi_insert(c);
+    return;
   }
+  if (E.cy == E.buf->num_rows) {
+    editor_append_row(E.buf, "", 0);
+  }
+  editor_row_insert_char(E.buf, editor_row(E.buf, E.cy), E.cx, c);
+  E.cx++;
+}
 
-  free(row->render);
-  row->render = malloc(row->size + tabs * (TAB_STOP - 1) + 1);
+// FILE IO//
 
-  for (j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t') {
-      row->render[idx++] = ' ';
-      while (idx % TAB_STOP != 0) {
-        row->render[idx++] = ' ';
-      }
-    } else {
-      row->render[idx++] = row->chars[j];
+// Tells the user if the file was cut short behind our back, taking the rows
+// not read from it yet along, and mends a line index found damaged
+void editor_check_map(void) {
+  if (editor_map_recover(E.buf)) {
+    editor_set_status_message("\"%.20s\" was cut short on disk, lines not "
+                              "yet read are lost",
+                              E.file);
+  }
+  if (E.buf->index_bad) {
+    editor_index_repair();
+  }
+}
+
+// Writes back only what changed while rows kept their place in the file,
+// anything else, or a file changed behind our back, is saved in full
+void editor_save() {
+  if (E.file == NULL)
+    return;
+  if (!editor_writable()) {
+    return;
+  }
+  editor_check_map();
+
+  int fd = open(E.file, O_RDWR);
+  long long written = fd == -1 ? -1 : editor_save_in_place(E.buf, fd);
+  if (written >= 0) {
+    if (close(fd) == 0) {
+      editor_set_status_message("\"%s\" %dL, %lldb written in place", E.file,
+                                E.buf->num_rows, written);
+      return;
     }
+    fd = -1;
+  }
+  // Every row is about to be written, so a damaged cached index has to
+  // show before, not halfway through
+  int j, len;
+  for (j = 0; j < E.buf->index_rows; j++) {
+    editor_row_text(E.buf, j, &len);
   }
+  editor_check_map();
+  if (fd == -1) {
+    fd = open(E.file, O_RDWR | O_CREAT, 0644);
+  }
+  written = fd == -1 ? -1 : editor_save_rewrite(E.buf, fd);
+  if (fd != -1 && close(fd) == -1) {
+    written = -1;
+  }
+  if (written >= 0) {
+    editor_set_status_message("\"%s\" %dL, %lldb written to disk", E.file,
+                              E.buf->num_rows, written);
+    return;
+  }
+  editor_set_status_message("Can't save! I/O error: %s", strerror(errno));
+}
 
-  row->render[idx] = '\0';
-  row->rsize = idx;
+// Reads at most max new bytes from the source into rows, returns bytes read
+ssize_t editor_ingest_source(size_t max) {
+  static char buf[INGEST_CHUNK];
+  size_t total = 0;
+  while (total < max) {
+    ssize_t n = read(E.src_fd, buf, sizeof(buf));
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return total ? (ssize_t)total : n;
+    }
+    editor_ingest(E.buf, buf, n);
+    E.src_off += n;
+    total += n;
+  }
+  return total;
 }
-void editor_append_row(char *s, size_t len) {
-  E.row = realloc(E.row, sizeof(erow) * (E.num_rows + 1));
 
-  int at = E.num_rows;
-  E.row[at].size = len;
-  E.row[at].chars = malloc(len + 1);
-  memcpy(E.row[at].chars, s, len);
-  E.row[at].chars[len] = '\0';
+// A cached line index, followed by rows + 1 offsets and then the bytes each
+// POS_BLOCK rows hold once read in. It describes the file with this device,
+// inode, size and mtime and no other.
+typedef struct LineIndexHeader {
+  char magic[8];
+  uint64_t dev, ino, size;
+  int64_t mtime_sec, mtime_nsec;
+  uint64_t rows;
+  int32_t tail_open;
+  int32_t cx, cy, row_off, col_off; // where the cursor was left
+  int32_t crs;                      // 1 if some line ends in a CR
+} line_index_header;
+
+// Where the line index of path is cached, NULL if there is nowhere to put
+// it. Files are told apart by a hash of their absolute path.
+char *editor_index_path(const char *path) {
+  char *abs = realpath(path, NULL);
+  if (abs == NULL) {
+    return NULL;
+  }
+  uint64_t h = frame_hash(abs, strlen(abs));
+  free(abs);
 
-  E.row[at].rsize = 0;
-  E.row[at].render = NULL;
-  editor_update_row(&E.row[at]);
+  const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+  const char *base = xdg && xdg[0] ? xdg : home;
+  if (base == NULL || base[0] == '\0') {
+    return NULL;
+  }
+  char *out = malloc(strlen(base) + 48);
+  sprintf(out, base == xdg ? "%s" : "%s/.cache", base);
+  mkdir(out, 0700);
+  strcat(out, "/quill");
+  mkdir(out, 0700);
+  sprintf(&out[strlen(out)], "/%016llx.idx", (unsigned long long)h);
+  return out;
+}
 
-  E.num_rows++;
+// Bytes of an index of rows rows, header and block sums included
+size_t editor_index_size(uint64_t rows) {
+  return sizeof(line_index_header) +
+         (rows + 1 + (rows + POS_BLOCK - 1) / POS_BLOCK) * sizeof(uint64_t);
 }
 
-void editor_row_insert_char(erow *row, int at, int c) {
-  if (at < 0 || at > row->size)
-    at = row->size;
-  row->chars = realloc(row->chars, row->size + 2);
-  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-  row->size++;
-  row->chars[at] = c;
-  editor_update_row(row);
+int editor_index_matches(const line_index_header *h, const struct stat *st) {
+  return memcmp(h->magic, INDEX_MAGIC, 8) == 0 &&
+         h->dev == (uint64_t)st->st_dev && h->ino == (uint64_t)st->st_ino &&
+         h->size == (uint64_t)st->st_size &&
+         h->mtime_sec == (int64_t)st->st_mtim.tv_sec &&
+         h->mtime_nsec == (int64_t)st->st_mtim.tv_nsec;
 }
 
-// EDITOR OPERATIONS //
-void editorInsertChar(int c) {
-  if (E.cy == E.num_rows) {
-    editor_append_row("", 0);
+// Maps the cached index of the open file if it still describes it, NULL if
+// it has to be rebuilt
+line_index_header *editor_index_load(size_t *len) {
+  int fd = open(E.buf->index_file, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
   }
-  editor_row_insert_char(&E.row[E.cy], E.cx, c);
-  E.cx++;
+  struct stat st;
+  void *mem = MAP_FAILED;
+  if (fstat(fd, &st) == 0 &&
+      (size_t)st.st_size >= sizeof(line_index_header)) {
+    mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mem == MAP_FAILED) {
+    return NULL;
+  }
+
+  line_index_header *h = mem;
+  const uint64_t *off = (const uint64_t *)(h + 1);
+  *len = st.st_size;
+  if (!editor_index_matches(h, &E.buf->file_stat) || h->rows == 0 ||
+      h->rows > INT_MAX || *len != editor_index_size(h->rows) ||
+      off[0] != 0 || off[h->rows] != h->size + (h->tail_open != 0)) {
+    munmap(mem, *len);
+    return NULL;
+  }
+  // Offsets are checked by the rows as they are looked at, but the block
+  // sums go into the position index now. A block holds at least a newline
+  // a row and at most what its rows span.
+  const uint64_t *sums = &off[h->rows + 1];
+  uint64_t first;
+  for (first = 0; first < h->rows; first += POS_BLOCK) {
+    uint64_t last = first + POS_BLOCK < h->rows ? first + POS_BLOCK : h->rows;
+    uint64_t sum = sums[first / POS_BLOCK];
+    if (sum < last - first || off[last] < off[first] ||
+        sum > off[last] - off[first]) {
+      munmap(mem, *len);
+      return NULL;
+    }
+  }
+  return h;
 }
 
-// FILE IO//
+// Finds every line in the map, laid out the way the index is cached. NULL if
+// there are more lines than rows can count.
+line_index_header *editor_index_build(const char *map, size_t map_len,
+                                      size_t *len) {
+  size_t cap = 1 << 16, rows = 0;
+  int crs = 0;
+  line_index_header *h = malloc(sizeof(*h) + cap * sizeof(uint64_t));
+  uint64_t *off = (uint64_t *)(h + 1);
+  uint64_t *sums = calloc(cap / POS_BLOCK, sizeof(uint64_t));
+  const char *p = map, *end = map + map_len;
+  while (p < end) {
+    if (rows + 2 > cap) {
+      if (cap > INT_MAX) {
+        free(h);
+        free(sums);
+        return NULL;
+      }
+      cap *= 2;
+      h = realloc(h, sizeof(*h) + cap * sizeof(uint64_t));
+      off = (uint64_t *)(h + 1);
+      sums = realloc(sums, cap / POS_BLOCK * sizeof(uint64_t));
+      memset(&sums[cap / 2 / POS_BLOCK], 0,
+             cap / 2 / POS_BLOCK * sizeof(uint64_t));
+    }
+    off[rows] = p - map;
+    const char *nl = memchr(p, '\n', end - p);
+    // Summed the way rows are read in, without the CRs before a newline
+    size_t n = (nl ? nl : end) - p;
+    while (nl && n > 0 && p[n - 1] == '\r') {
+      n--;
+      crs = 1;
+    }
+    sums[rows++ / POS_BLOCK] += n + 1;
+    p = nl ? nl + 1 : end;
+  }
+  *len = editor_index_size(rows);
+  h = realloc(h, *len);
+  off = (uint64_t *)(h + 1);
+  memcpy(&off[rows + 1], sums,
+         (rows + POS_BLOCK - 1) / POS_BLOCK * sizeof(uint64_t));
+  free(sums);
+
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, INDEX_MAGIC, 8);
+  h->dev = E.buf->file_stat.st_dev;
+  h->ino = E.buf->file_stat.st_ino;
+  h->size = E.buf->file_stat.st_size;
+  h->mtime_sec = E.buf->file_stat.st_mtim.tv_sec;
+  h->mtime_nsec = E.buf->file_stat.st_mtim.tv_nsec;
+  h->rows = rows;
+  h->tail_open = map[map_len - 1] != '\n';
+  h->crs = crs;
+  off[rows] = map_len + h->tail_open;
+  return h;
+}
 
-char *editor_rows_to_string(int *buf_len) {
-  int tot_len = 0;
-  int j;
-  for (j = 0; j < E.num_rows; j++) {
-    tot_len += E.row[j].size + 1;
-  }
-  *buf_len = tot_len;
-  char *buf = malloc(tot_len);
-  char *p = buf;
-  for (j = 0; j < E.num_rows; j++) {
-    memcpy(p, E.row[j].chars, E.row[j].size);
-    p += E.row[j].size;
-    *p = '\n';
-    p++;
+// Writes the index under a temporary name first, so nobody ever maps half
+// of one
+void editor_index_store(line_index_header *h, size_t len) {
+  char *tmp = malloc(strlen(E.buf->index_file) + 16);
+  sprintf(tmp, "%s.%d", E.buf->index_file, (int)getpid());
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1) {
+    free(tmp);
+    return;
   }
-  return buf;
+  const char *p = (const char *)h;
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = write(fd, &p[done], len - done);
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+  if (close(fd) == 0 && done == len) {
+    rename(tmp, E.buf->index_file);
+  } else {
+    unlink(tmp);
+  }
+  free(tmp);
 }
 
-void editor_save() {
-  if (E.file == NULL)
+// Remembers the cursor for the next time the file is opened, unless the
+// file has changed since and its index has gone stale with it
+void editor_index_save_position(void) {
+  struct stat st;
+  if (E.buf->index_file == NULL || stat(E.file, &st) == -1) {
     return;
-  int len;
-  char *buf = editor_rows_to_string(&len);
-  int fd = open(E.file, O_RDWR | O_CREAT, 0644);
-  if (fd != -1) {
-    if (ftruncate(fd, len) != -1) {
-      if (write(fd, buf, len) == len) {
-        close(fd);
-        free(buf);
-        editor_set_status_message("\"%s\" %dL, %db written to disk", E.file,
-                                  E.num_rows, len);
-        return;
+  }
+  int fd = open(E.buf->index_file, O_RDWR);
+  if (fd == -1) {
+    return;
+  }
+  line_index_header h;
+  if (pread(fd, &h, sizeof(h), 0) == sizeof(h) &&
+      editor_index_matches(&h, &st)) {
+    h.cx = E.cx;
+    h.cy = E.cy;
+    h.row_off = E.row_off;
+    h.col_off = E.col_off;
+    pwrite(fd, &h, sizeof(h), 0);
+  }
+  close(fd);
+}
+
+// Lays out a row for each line of the index, to be filled in from the map
+// when first looked at
+void editor_use_index(line_index_header *h, size_t len, int cached) {
+  E.buf->index = (const uint64_t *)(h + 1);
+  E.buf->index_rows = h->rows;
+  E.buf->index_blocks = &E.buf->index[h->rows + 1];
+  E.buf->index_mem = h;
+  E.buf->index_len = len;
+  E.buf->index_mapped = cached;
+  E.buf->index_crs = h->crs;
+  E.buf->index_bad = 0;
+  E.buf->tail_open = h->tail_open;
+  E.buf->row = calloc(h->rows, sizeof(erow));
+  E.buf->row_cap = E.buf->num_rows = h->rows;
+  E.buf->disk_rows = h->rows;
+  E.buf->disk_len = E.buf->map_len;
+  editor_pos_from_index(E.buf);
+}
+
+// Builds the line index again once a cached one was found pointing outside
+// the file. Rows no one has looked at yet take their places from the new
+// index if it has as many; otherwise, as long as nothing was edited, the
+// rows are laid out anew. Edited rows are never thrown away.
+void editor_index_repair(void) {
+  ebuffer *buf = E.buf;
+  size_t len;
+  line_index_header *h = NULL;
+  buf->index_bad = 0;
+  if (E.buf->index_file) {
+    unlink(E.buf->index_file);
+  }
+  if (buf->index && buf->map) {
+    h = editor_index_build(buf->map, buf->map_len, &len);
+  }
+  if (h && E.buf->index_file) {
+    editor_index_store(h, len);
+  }
+  if (h && h->rows == (uint64_t)buf->index_rows) {
+    // Rows read in empty past a bad entry go back to being unread
+    int j;
+    for (j = 0; j < buf->index_rows; j++) {
+      erow *row = &buf->row[j];
+      if (row->chars && !row->dirty && row->off == 0 && row->size == 0) {
+        buf->mem_chars -= mem_size(row->chars);
+        editor_row_drop_render(buf, row);
+        free(row->chars);
+        row->chars = NULL;
       }
     }
-    close(fd);
+    editor_release_index(buf);
+    buf->index = (const uint64_t *)(h + 1);
+    buf->index_rows = h->rows;
+    buf->index_mem = h;
+    buf->index_len = len;
+    buf->index_crs = h->crs;
+    editor_pos_rebuild(buf);
+    editor_set_status_message("Line index was damaged, rebuilt it");
+    return;
   }
-  free(buf);
-  editor_set_status_message("Can't save! I/O error: %s", strerror(errno));
+  if (h && buf->num_dirty == 0 && !buf->relayout &&
+      buf->num_rows == buf->index_rows) {
+    int j;
+    for (j = 0; j < buf->num_rows; j++) {
+      editor_row_drop_render(buf, &buf->row[j]);
+      free(buf->row[j].chars);
+    }
+    buf->mem_chars = 0;
+    free(buf->row);
+    editor_release_index(buf);
+    editor_use_index(h, len, 0);
+    editor_clamp_cursors();
+    editor_set_status_message("Line index was damaged, rebuilt it");
+    return;
+  }
+  free(h);
+  // The rows left can't be told apart from the file, so all of it is
+  // written out on the next save
+  editor_release_index(buf);
+  buf->relayout = 1;
+  editor_pos_rebuild(buf);
+  editor_set_status_message("Line index was damaged, unread lines are empty");
 }
 
-void editor_open(char *filename) {
-  FILE *fp = fopen(filename, "r");
+// Maps a regular file and indexes its lines instead of reading it into rows,
+// which are then loaded from the map as they are looked at. The index of a
+// big file is cached, so opening it again unchanged doesn't scan it at all.
+// Returns 0 if the file can't be mapped.
+int editor_open_mapped(void) {
+  size_t map_len = E.buf->file_stat.st_size;
+  if (!S_ISREG(E.buf->file_stat.st_mode) || map_len == 0) {
+    return 0;
+  }
+  void *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, E.src_fd, 0);
+  if (map == MAP_FAILED) {
+    return 0;
+  }
+
+  size_t len;
+  line_index_header *h = NULL;
+  if (map_len >= INDEX_MIN_SIZE) {
+    E.buf->index_file = editor_index_path(E.file);
+  }
+  if (E.buf->index_file) {
+    h = editor_index_load(&len);
+  }
+  int cached = h != NULL;
+  if (!cached) {
+    h = editor_index_build(map, map_len, &len);
+    if (h == NULL) {
+      munmap(map, map_len);
+      return 0;
+    }
+    if (E.buf->index_file) {
+      editor_index_store(h, len);
+    }
+  }
+
+  E.buf->map = map;
+  E.buf->map_len = map_len;
+  editor_map_guard(E.buf);
+  editor_use_index(h, len, cached);
+  E.src_off = map_len;
+  lseek(E.src_fd, map_len, SEEK_SET);
+
+  if (cached && h->cy >= 0 && h->cy < E.buf->num_rows) {
+    E.cy = h->cy;
+    E.row_off = h->row_off >= 0 && h->row_off <= E.cy ? h->row_off : E.cy;
+    E.col_off = h->col_off >= 0 ? h->col_off : 0;
+    E.cx = h->cx;
+    if (E.cx < 0 || E.cx > editor_row(E.buf, E.cy)->size) {
+      E.cx = 0;
+    }
+  }
+  return 1;
+}
+
+// Loads filename from fd, open on it for reading. Returns -1 with errno set
+// if it can't be read, with whatever rows it got so far left in the buffer.
+int editor_open_fd(char *filename, int fd) {
   free(E.file);
   E.file = strdup(filename);
-  if (!fp) {
-    die("fopen");
+  E.src_fd = fd;
+  int ok = fstat(E.src_fd, &E.buf->file_stat) == 0;
+  if (ok && !editor_open_mapped()) {
+    ssize_t n;
+    while ((n = editor_ingest_source(INGEST_TICK_MAX)) > 0)
+      ;
+    ok = n == 0;
+  }
+  if (!ok || !E.follow) {
+    int err = errno;
+    close(E.src_fd);
+    E.src_fd = -1;
+    errno = err;
+  }
+  return ok ? 0 : -1;
+}
+
+void editor_open(char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1 || editor_open_fd(filename, fd) == -1) {
+    die(filename);
+  }
+}
+
+// Reads piped input from stdin in the background of the event loop
+void editor_open_stdin(void) {
+  E.src_fd = STDIN_FILENO;
+  E.streaming = 1;
+  int flags = fcntl(E.src_fd, F_GETFL);
+  if (flags == -1 || fcntl(E.src_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    die("fcntl");
+  }
+}
+
+// Drains what the pipe has for us now, called whenever poll() flags it
+void editor_stream_poll(void) {
+  ssize_t n = editor_ingest_source(INGEST_TICK_MAX);
+  if (n == -1 && errno == EAGAIN) {
+    return;
+  }
+  E.redraw = 1;
+  if (n > 0) {
+    return;
+  }
+
+  if (n == -1) {
+    editor_set_status_message("Read error: %s", strerror(errno));
+  } else {
+    editor_set_status_message("%d lines read from stdin", E.buf->num_rows);
+  }
+  close(E.src_fd);
+  E.src_fd = -1;
+  E.streaming = 0;
+}
+
+// Picks up whatever has been appended to the followed file since last time
+void editor_follow_poll(void) {
+  struct stat st;
+  if (!E.follow || fstat(E.src_fd, &st) == -1) {
+    return;
+  }
+
+  if (st.st_size < E.src_off) {
+    // Truncated or rotated in place, start over from the top like tail -F
+    editor_free_rows(E.buf);
+    E.buf->tail_open = 0;
+    E.src_off = 0;
+    E.cx = E.cy = E.row_off = E.col_off = 0;
+    lseek(E.src_fd, 0, SEEK_SET);
+    editor_set_status_message("\"%s\" truncated, reloading", E.file);
+    E.redraw = 1;
+  }
+  if (st.st_size == E.src_off) {
+    return;
   }
 
-  char *line = NULL;
-  size_t line_cap = 0;
-  ssize_t line_len;
-  while ((line_len = getline(&line, &line_cap, fp)) != -1) {
-    while (line_len > 0 &&
-           (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')) {
-      line_len--;
+  int at_end = E.cy >= E.buf->num_rows - 1;
+  if (editor_ingest_source(INGEST_TICK_MAX) > 0) {
+    if (at_end && E.buf->num_rows > 0) {
+      E.cy = E.buf->num_rows - 1;
+      E.cx = 0;
     }
-    editor_append_row(line, line_len);
+    E.redraw = 1;
   }
-  free(line);
-  fclose(fp);
 }
 
-// APPEND BUFFER//
-typedef struct AppendBuffer {
-  char *b;
-  int len;
-} append_buffer;
+// Starts or stops tailing the open file from where loading left off
+void editor_toggle_follow(void) {
+  if (E.follow) {
+    E.follow = 0;
+    close(E.src_fd);
+    E.src_fd = -1;
+    editor_set_status_message("Stopped following");
+    return;
+  }
+  if (E.file == NULL || E.streaming) {
+    editor_set_status_message("No file to follow");
+    return;
+  }
+  if (E.client) {
+    // Each client would read the growth into the shared buffer again
+    editor_set_status_message("Can't follow from a client");
+    return;
+  }
+
+  E.src_fd = open(E.file, O_RDONLY);
+  if (E.src_fd == -1 || lseek(E.src_fd, E.src_off, SEEK_SET) == -1) {
+    editor_set_status_message("Can't follow: %s", strerror(errno));
+    if (E.src_fd != -1) {
+      close(E.src_fd);
+    }
+    E.src_fd = -1;
+    return;
+  }
+  E.follow = 1;
+  if (E.buf->num_rows > 0) {
+    E.cy = E.buf->num_rows - 1;
+    E.cx = 0;
+  }
+  editor_set_status_message("Following \"%s\" (Ctrl-F to stop)", E.file);
+}
+
+// MEMORY //
+
+// Human readable byte count, e.g. 12.3M
+char *format_bytes(char *buf, size_t buf_len, double bytes) {
+  const char *units = "BKMGT";
+  int u = 0;
+  while (bytes >= 1024 && units[u + 1]) {
+    bytes /= 1024;
+    u++;
+  }
+  snprintf(buf, buf_len, u ? "%.1f%c" : "%.0f%c", bytes, units[u]);
+  return buf;
+}
+
+// Everything Quill tracks, without walking the rows
+size_t editor_mem_total(void) {
+  return E.buf->mem_chars + E.buf->mem_render + mem_size(E.buf->row) +
+         (E.buf->index_mapped ? 0 : mem_size(E.buf->index_mem)) +
+         mem_size(E.buf->dirty) + mem_size(E.buf->pos_tree) +
+         E.mem_frame + mem_size(E.frame) + mem_size(E.macro);
+}
+
+// Walks every row to split allocations into what is used and what is slack,
+// then appends the breakdown to fp
+void editor_mem_report(FILE *fp) {
+  size_t chars_used = 0, render_used = 0;
+  long rendered = 0, loaded = 0;
+  int j;
+  for (j = 0; j < E.buf->num_rows; j++) {
+    if (E.buf->row[j].chars) {
+      chars_used += E.buf->row[j].size + 1;
+      loaded++;
+    }
+    if (E.buf->row[j].render) {
+      render_used += E.buf->row[j].rsize + 1;
+      rendered++;
+    }
+  }
+  size_t table_used = sizeof(erow) * E.buf->num_rows;
+
+  char a[16], b[16], c[16];
+  fprintf(fp, "quill memory report: %s, %d rows\n",
+          E.file ? E.file : "[No Name]", E.buf->num_rows);
+  fprintf(fp, "  %-14s %10s %10s %10s\n", "", "allocated", "used", "slack");
+#define MEM_LINE(name, alloc, used)                                            \
+  fprintf(fp, "  %-14s %10s %10s %10s\n", name,                                \
+          format_bytes(a, sizeof(a), alloc),                                   \
+          format_bytes(b, sizeof(b), used),                                    \
+          format_bytes(c, sizeof(c), (double)(alloc) - (double)(used)))
+  MEM_LINE("chars", E.buf->mem_chars, chars_used);
+  MEM_LINE("render", E.buf->mem_render, render_used);
+  MEM_LINE("row table", mem_size(E.buf->row), table_used);
+  MEM_LINE("line index", E.buf->index_len, E.buf->index_len);
+  MEM_LINE("dirty rows", mem_size(E.buf->dirty),
+           sizeof(dirty_row) * E.buf->num_dirty);
+  MEM_LINE("position index", mem_size(E.buf->pos_tree),
+           sizeof(long long) * (E.buf->pos_blocks + 1));
+  MEM_LINE("frame buffer", E.mem_frame, E.mem_frame);
+  MEM_LINE("frame hashes", mem_size(E.frame), mem_size(E.frame));
+  MEM_LINE("macro", mem_size(E.macro), (size_t)E.macro_len);
+#undef MEM_LINE
+  fprintf(fp, "  rows loaded: %ld of %d, %s of the file mapped%s\n", loaded,
+          E.buf->num_rows, format_bytes(a, sizeof(a), E.buf->map_len),
+          E.buf->index_mapped ? ", index from cache" : "");
+  fprintf(fp, "  rows with render: %ld of %d\n", rendered, E.buf->num_rows);
+  fprintf(fp, "  tracked total: %s",
+          format_bytes(a, sizeof(a), editor_mem_total()));
+  if (E.mem_budget) {
+    fprintf(fp, " (budget %s)", format_bytes(b, sizeof(b), E.mem_budget));
+  }
+  fprintf(fp, "\n");
+
+  // Free chunks the allocator holds on to but can't hand back are the
+  // fragmentation cost of all the small per-row allocations
+  struct mallinfo2 mi = mallinfo2();
+  fprintf(fp, "  heap: %s in use, %s free in arena, %s mmapped\n",
+          format_bytes(a, sizeof(a), mi.uordblks),
+          format_bytes(b, sizeof(b), mi.fordblks),
+          format_bytes(c, sizeof(c), mi.hblkhd));
+}
 
-#define ABUF_INIT                                                              \
-  { NULL, 0 }
+void editor_mem_dump(void) {
+  FILE *fp = fopen(E.mem_report, "a");
+  if (fp) {
+    editor_mem_report(fp);
+    fclose(fp);
+  }
+}
 
-void abuf_append(append_buffer *abuf, const char *s, int len) {
-  char *new = realloc(abuf->b, abuf->len + len);
-  if (new == NULL) {
+// Drops render for every row off screen once the budget is blown. It is
+// rebuilt from chars if the row is drawn again.
+void editor_mem_enforce_budget(void) {
+  if (E.mem_budget == 0 || editor_mem_total() <= E.mem_budget ||
+      E.buf->mem_render <= E.mem_render_floor + MEM_EVICT_SLACK) {
     return;
   }
-  memcpy(&new[abuf->len], s, len);
-  abuf->b = new;
-  abuf->len += len;
+
+  size_t before = E.buf->mem_render;
+  int j;
+  for (j = 0; j < E.buf->num_rows; j++) {
+    if (j < E.row_off || j >= E.row_off + E.screen_rows) {
+      if (E.buf->row[j].render) {
+        editor_row_drop_render(E.buf, &E.buf->row[j]);
+      }
+    }
+  }
+  E.mem_render_floor = E.buf->mem_render;
+
+  char a[16];
+  editor_set_status_message(
+      "Over memory budget, evicted %s of rendered rows",
+      format_bytes(a, sizeof(a), before - E.buf->mem_render));
 }
 
-void abuf_free(append_buffer *abuf) { free(abuf->b); }
+void editor_toggle_mem_status(void) {
+  E.mem_status = !E.mem_status;
+  if (E.mem_status && E.mem_report) {
+    editor_mem_dump();
+    editor_set_status_message("Memory report appended to %s", E.mem_report);
+  }
+}
 
 // OUTPUT //
 
 // Scrolling
 void editor_scroll() {
   E.rx = 0;
-  if (E.cy < E.num_rows) {
-    E.rx = editor_row_conversion(&E.row[E.cy], E.cx);
+  if (E.cy < E.buf->num_rows) {
+    E.rx = editor_row_conversion(editor_row(E.buf, E.cy), E.cx);
   }
 
   if (E.cy < E.row_off) {
@@ -370,26 +1037,85 @@ void editor_draw_welcome(append_buffer *abuf) {
   abuf_append(abuf, welcome, welcome_len);
 }
 
-// Drawing ~ to mark all rows
-void editor_draw_rows(append_buffer *abuf) {
-  int y;
-  for (y = 0; y < E.screen_rows - 1; y++) {
-    int filerow = y + E.row_off;
-    if (filerow < E.num_rows) {
-      int len = E.row[filerow].rsize - E.col_off;
-      if (len < 0) {
-        len = 0;
+// Draws the len visible columns of row at, with the extra cursors and the
+// block on it in reverse video, even where they lie past the row's end
+void editor_draw_marked(append_buffer *abuf, erow *row, int at, int len) {
+  char *mark = calloc(E.screen_cols + 1, 1);
+  int end = len, x, j;
+  if (E.block && (at >= E.block_cy || at >= E.cy) &&
+      (at <= E.block_cy || at <= E.cy)) {
+    int left = E.block_rx < E.rx ? E.block_rx : E.rx;
+    int right = E.block_rx < E.rx ? E.rx : E.block_rx;
+    for (x = left; x < right || x == left; x++) {
+      if (x - E.col_off >= 0 && x - E.col_off < E.screen_cols) {
+        mark[x - E.col_off] = 1;
       }
-      abuf_append(abuf, &E.row[filerow].render[E.col_off], len);
-    } else {
-      if (E.num_rows == 0 && y == E.screen_rows / 2) {
-        editor_draw_welcome(abuf);
-      } else {
-        abuf_append(abuf, "~", 1);
+    }
+    x = right - E.col_off + (right == left);
+    end = x > end ? x : end;
+  }
+  for (j = 0; j < E.num_cursors; j++) {
+    if (E.cursors[j].cy == at) {
+      int cx = E.cursors[j].cx < row->size ? E.cursors[j].cx : row->size;
+      x = editor_row_conversion(row, cx) - E.col_off;
+      if (x >= 0 && x < E.screen_cols) {
+        mark[x] = 1;
+        end = x + 1 > end ? x + 1 : end;
       }
     }
-    abuf_append(abuf, "\x1b[K", 3); // Clearing lines as they are redrawn
-    abuf_append(abuf, "\r\n", 2);
+  }
+  if (end > E.screen_cols) {
+    end = E.screen_cols;
+  }
+
+  // One run of marked or unmarked columns at a time
+  for (x = 0; x < end; x = j) {
+    for (j = x; j < end && mark[j] == mark[x]; j++) {
+    }
+    if (mark[x]) {
+      abuf_append(abuf, "\x1b[7m", 4);
+    }
+    int shown = (j < len ? j : len) - x;
+    if (shown > 0) {
+      abuf_append(abuf, &row->render[E.col_off + x], shown);
+    }
+    for (shown = shown > 0 ? shown : 0; x + shown < j; shown++) {
+      abuf_append(abuf, " ", 1);
+    }
+    if (mark[x]) {
+      abuf_append(abuf, "\x1b[m", 3);
+    }
+  }
+  free(mark);
+}
+
+// Drawing a single text row, or ~ past the end of the file
+void editor_draw_row(append_buffer *abuf, int y) {
+  int filerow = y + E.row_off;
+  if (filerow < E.buf->num_rows) {
+    erow *row = editor_row(E.buf, filerow);
+    if (row->render == NULL) {
+      // Left stale by a batch edit, or never drawn
+      editor_update_row(E.buf, row);
+    }
+    int len = row->rsize - E.col_off;
+    if (len < 0) {
+      len = 0;
+    }
+    if (len > E.screen_cols) {
+      len = E.screen_cols;
+    }
+    if (E.num_cursors || E.block) {
+      editor_draw_marked(abuf, row, filerow, len);
+    } else {
+      abuf_append(abuf, &row->render[E.col_off], len);
+    }
+  } else {
+    if (E.buf->num_rows == 0 && y == E.screen_rows / 2) {
+      editor_draw_welcome(abuf);
+    } else {
+      abuf_append(abuf, "~", 1);
+    }
   }
 }
 
@@ -397,30 +1123,55 @@ void editor_draw_rows(append_buffer *abuf) {
 void editor_draw_status_bar(append_buffer *ab) {
   abuf_append(ab, "\x1b[7m", 4);
   char status[80], rstatus[80];
-  int len = snprintf(status, sizeof(status), "%.20s - %d lines",
-                     E.file ? E.file : "[No Name]", E.num_rows);
-  int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", E.cy + 1, E.num_rows);
-  if (len > E.screen_cols) {
-    len = E.screen_cols;
+  int len;
+  if (E.mem_status) {
+    char total[16], chars[16], render[16], table[16];
+    len = snprintf(status, sizeof(status),
+                   "mem %s: chars %s render %s rows %s",
+                   format_bytes(total, sizeof(total), editor_mem_total()),
+                   format_bytes(chars, sizeof(chars), E.buf->mem_chars),
+                   format_bytes(render, sizeof(render), E.buf->mem_render),
+                   format_bytes(table, sizeof(table), mem_size(E.buf->row)));
+  } else {
+    len = snprintf(status, sizeof(status), "%.20s - %d lines%s",
+                   E.file ? E.file : "[No Name]", E.buf->num_rows,
+                   E.follow      ? " (following)"
+                   : E.streaming ? " (reading)"
+                   : E.recording ? " (recording)"
+                                 : "");
+  }
+  // Byte position of the cursor, through the position index
+  long long total = editor_buffer_bytes(E.buf);
+  long long at = editor_row_offset(E.buf, E.cy);
+  if (E.cy < E.buf->num_rows) {
+    at += E.cx;
+  }
+  int rlen = snprintf(rstatus, sizeof(rstatus), "@%lld %d%% %d/%d", at,
+                      total ? (int)(at * 100 / total) : 0, E.cy + 1,
+                      E.buf->num_rows);
+  if (len >= (int)sizeof(status)) {
+    len = sizeof(status) - 1;
+  }
+  if (rlen > E.screen_cols) {
+    rlen = E.screen_cols;
+  }
+  // The left part gives way, keeping a space before the position if it fits
+  int room = E.screen_cols - rlen - (rlen < E.screen_cols);
+  if (len > room) {
+    len = room;
   }
 
   abuf_append(ab, status, len);
-
-  while (len < E.screen_cols) {
-    if (E.screen_cols - len == rlen) {
-      abuf_append(ab, rstatus, rlen);
-      break;
-    }
+  while (len < E.screen_cols - rlen) {
     abuf_append(ab, " ", 1);
     len++;
   }
+  abuf_append(ab, rstatus, rlen);
   abuf_append(ab, "\x1b[m", 3);
-  abuf_append(ab, "\r\n", 2);
 }
 
 // Draws the message bar on the screen
 void editor_draw_message_bar(append_buffer *ab) {
-  abuf_append(ab, "\x1b[K", 3);
   int msg_len = strlen(E.statusmsg);
   if (msg_len > E.screen_cols) {
     msg_len = E.screen_cols;
@@ -429,19 +1180,86 @@ void editor_draw_message_bar(append_buffer *ab) {
     abuf_append(ab, E.statusmsg, msg_len);
   }
 }
+
+// FNV-1a, never 0 so a zeroed slot always reads as "unknown"
+uint64_t frame_hash(const char *s, int len) {
+  uint64_t h = 14695981039346656037ULL;
+  int j;
+  for (j = 0; j < len; j++) {
+    h = (h ^ (unsigned char)s[j]) * 1099511628211ULL;
+  }
+  return h | 1;
+}
+
+// Sends screen line y only if the terminal isn't already showing it
+void editor_emit_line(append_buffer *abuf, int y, append_buffer *line) {
+  uint64_t h = frame_hash(line->b, line->len);
+  if (E.frame[y] != h) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;1H", y + 1);
+    abuf_append(abuf, buf, len);
+    abuf_append(abuf, line->b, line->len);
+    abuf_append(abuf, "\x1b[K", 3); // Clearing lines as they are redrawn
+    E.frame[y] = h;
+  }
+  line->len = 0;
+}
+
+// Moves what the terminal already shows by the change in row_off, using a
+// scroll region over the text rows, so only the exposed lines need sending
+void editor_scroll_frame(append_buffer *abuf) {
+  int shift = E.row_off - E.frame_row_off;
+  E.frame_row_off = E.row_off;
+  if (shift == 0 || abs(shift) >= E.screen_rows) {
+    return;
+  }
+
+  char buf[48];
+  int len = snprintf(buf, sizeof(buf), "\x1b[1;%dr\x1b[%d%c\x1b[r",
+                     E.screen_rows, abs(shift), shift > 0 ? 'S' : 'T');
+  abuf_append(abuf, buf, len);
+
+  int keep = E.screen_rows - abs(shift);
+  if (shift > 0) {
+    memmove(&E.frame[0], &E.frame[shift], keep * sizeof(uint64_t));
+    memset(&E.frame[keep], 0, shift * sizeof(uint64_t));
+  } else {
+    memmove(&E.frame[-shift], &E.frame[0], keep * sizeof(uint64_t));
+    memset(&E.frame[0], 0, -shift * sizeof(uint64_t));
+  }
+}
+
 // Clears the screen
 void editor_refresh_screen() {
+  if (E.replay_pos >= 0) {
+    return; // Macro replay draws once, when it is done
+  }
+  editor_check_map();
   editor_scroll();
+  if (E.frame == NULL) {
+    // One hash per text row plus the status and message bars
+    E.frame = calloc(E.screen_rows + 2, sizeof(uint64_t));
+    E.frame_row_off = E.row_off;
+  }
 
   append_buffer abuf = ABUF_INIT;
+  append_buffer line = ABUF_INIT;
 
+  if (E.sync_output) {
+    abuf_append(&abuf, "\x1b[?2026h", 8); // Begin synchronized update
+  }
   abuf_append(&abuf, "\x1b[?25l", 6); // Hiding cursor
-  abuf_append(&abuf, "\x1b[H", 3);    // Position the cursor at top left
-                                      //
-  editor_draw_rows(&abuf);
-  editor_draw_status_bar(&abuf);
-  editor_draw_message_bar(&abuf);
-  // Keystroke handling for movement
+  editor_scroll_frame(&abuf);
+
+  int y;
+  for (y = 0; y < E.screen_rows; y++) {
+    editor_draw_row(&line, y);
+    editor_emit_line(&abuf, y, &line);
+  }
+  editor_draw_status_bar(&line);
+  editor_emit_line(&abuf, E.screen_rows, &line);
+  editor_draw_message_bar(&line);
+  editor_emit_line(&abuf, E.screen_rows + 1, &line);
 
   // Moving cursor to last stored position before screen refresh
   char buf[32];
@@ -450,8 +1268,19 @@ void editor_refresh_screen() {
   abuf_append(&abuf, buf, strlen(buf));
 
   abuf_append(&abuf, "\x1b[?25h", 6); // Reshowing cursor
-  write(STDOUT_FILENO, abuf.b, abuf.len);
+  if (E.sync_output) {
+    abuf_append(&abuf, "\x1b[?2026l", 8);
+  }
+  write(E.out_fd, abuf.b, abuf.len);
+  E.mem_frame = mem_size(abuf.b) + mem_size(line.b);
   abuf_free(&abuf);
+  abuf_free(&line);
+
+  E.redraw = 0;
+  E.last_refresh = now_ms();
+  if (E.buf->index_bad) {
+    editor_refresh_screen(); // A row drawn just now found the index damaged
+  }
 }
 
 void editor_set_status_message(const char *fmt, ...) {
@@ -463,22 +1292,67 @@ void editor_set_status_message(const char *fmt, ...) {
 }
 // INPUT//
 
-// Movinng the cursor
-void editor_move_cursor(char key) {
-  erow *row = (E.cy >= E.num_rows) ? NULL : &E.row[E.cy];
-  switch (key) {
-  case 'h':
-    if (E.cx != 0) {
+// Reads a line of input on the message bar, NULL if cancelled with Escape.
+// Enter on an empty line only takes it if allow_empty is set.
+char *editor_prompt(char *prompt, int allow_empty) {
+  size_t buf_size = 128;
+  char *buf = malloc(buf_size);
+  size_t buf_len = 0;
+  buf[0] = '\0';
+
+  while (1) {
+    editor_set_status_message(prompt, buf);
+    editor_refresh_screen();
+
+    char c = editor_read_key();
+    if (c == BACKSPACE || c == CTRL_KEY('h')) {
+      if (buf_len != 0) {
+        buf[--buf_len] = '\0';
+      }
+    } else if (c == '\x1b' || E.detached) {
+      editor_set_status_message("");
+      free(buf);
+      return NULL;
+    } else if (c == '\r') {
+      if (buf_len != 0 || allow_empty) {
+        editor_set_status_message("");
+        return buf;
+      }
+    } else if (!iscntrl((unsigned char)c)) {
+      if (buf_len == buf_size - 1) {
+        buf_size *= 2;
+        buf = realloc(buf, buf_size);
+      }
+      buf[buf_len++] = c;
+      buf[buf_len] = '\0';
+    }
+  }
+}
+
+// Keeps the cursor inside the row it is on
+void editor_clamp_cx(void) {
+  int len = E.cy < E.buf->num_rows ? editor_row(E.buf, E.cy)->size : 0;
+  if (E.cx > len) {
+    E.cx = len;
+  }
+}
+
+// Movinng the cursor
+void editor_move_cursor(char key) {
+  erow *row = (E.cy >= E.buf->num_rows) ? NULL : editor_row(E.buf, E.cy);
+  switch (key) {
+  case 'h':
+    if (E.cx != 0) {
       E.cx--;
     } else if (E.cy > 0) {
       E.cy--;
-      E.cx = E.row[E.cy].size;
+      E.cx = editor_row(E.buf, E.cy)->size;
     }
     break;
   case 'l':
     if (row && E.cx < row->size) {
       E.cx++;
-    } else if (E.cy < E.num_rows) {
+    } else if (E.cy < E.buf->num_rows) {
       E.cy++;
       E.cx = 0;
     }
@@ -489,19 +1363,735 @@ void editor_move_cursor(char key) {
     }
     break;
   case 'j':
-    if (E.cy < E.num_rows) {
+    if (E.cy < E.buf->num_rows) {
       E.cy++;
     }
     break;
   }
 
-  row = (E.cy >= E.num_rows) ? NULL : &E.row[E.cy];
-  int len = row ? row->size : 0;
-  if (E.cx > len) {
-    E.cx = len;
+  editor_clamp_cx();
+}
+
+// Moves a screen up or down, the cursor keeping its place on the screen
+void editor_page(int dir) {
+  int max_off = E.buf->num_rows - E.screen_rows;
+  E.row_off += dir * E.screen_rows;
+  E.cy += dir * E.screen_rows;
+  if (E.row_off > max_off) {
+    E.row_off = max_off;
+  }
+  if (E.row_off < 0) {
+    E.row_off = 0;
+  }
+  if (E.cy >= E.buf->num_rows) {
+    E.cy = E.buf->num_rows > 0 ? E.buf->num_rows - 1 : 0;
+  }
+  if (E.cy < 0) {
+    E.cy = 0;
+  }
+  editor_clamp_cx();
+}
+
+// Jumps to a line, to @ a byte offset (decimal or 0x hex) or to N% of the
+// way through the buffer's bytes. Offsets go through the position index, so
+// this costs the same anywhere in a file of any size.
+void editor_goto(void) {
+  char *arg = editor_prompt("Go to line, @byte or N%%: %s", 0);
+  if (arg == NULL) {
+    return;
+  }
+  char *end;
+  int row, col = 0;
+  long long total = editor_buffer_bytes(E.buf);
+  if (arg[0] == '@') {
+    long long off = strtoll(&arg[1], &end, 0);
+    row = editor_offset_row(E.buf, off < 0 ? 0 : off, &col);
+  } else if (arg[strlen(arg) - 1] == '%') {
+    double pct = strtod(arg, &end);
+    end += *end == '%';
+    pct = pct < 0 ? 0 : pct > 100 ? 100 : pct;
+    row = editor_offset_row(E.buf, (long long)(total * pct / 100), &col);
+  } else {
+    long line = strtol(arg, &end, 10);
+    row = line < 1                 ? 0
+          : line > E.buf->num_rows ? E.buf->num_rows - 1
+                                   : line - 1;
+  }
+  int bad = end == arg || *end != '\0';
+  free(arg);
+  if (bad || E.buf->num_rows == 0) {
+    editor_set_status_message("Invalid position");
+    return;
+  }
+
+  E.cy = row;
+  E.cx = col;
+  editor_clamp_cx();
+  // Put a far jump in the middle of the screen
+  if (E.cy < E.row_off || E.cy >= E.row_off + E.screen_rows) {
+    E.row_off = E.cy > E.screen_rows / 2 ? E.cy - E.screen_rows / 2 : 0;
+  }
+  editor_set_status_message("Line %d of %d, byte %lld of %lld", E.cy + 1,
+                            E.buf->num_rows,
+                            editor_row_offset(E.buf, E.cy) + E.cx, total);
+}
+
+// MULTIPLE CURSORS //
+
+static int cursor_cmp(const void *a, const void *b) {
+  const cursor *x = a, *y = b;
+  if (x->cy != y->cy) {
+    return (x->cy > y->cy) - (x->cy < y->cy);
+  }
+  return (x->cx > y->cx) - (x->cx < y->cx);
+}
+
+// How many of the n sorted positions in at come before or at cx, cy
+static int cursor_rank(const cursor *at, int n, int cx, int cy) {
+  cursor key = {cx, cy};
+  int lo = 0, hi = n;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (cursor_cmp(&at[mid], &key) <= 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Render column of the cursor, worked out now as E.rx is only set by a draw
+int editor_cursor_rx(void) {
+  if (E.cy >= E.buf->num_rows) {
+    return 0;
+  }
+  return editor_row_conversion(editor_row(E.buf, E.cy), E.cx);
+}
+
+// Leaves a cursor where the cursor is and moves on to the line below
+void editor_add_cursor(void) {
+  int j;
+  for (j = 0; j < E.num_cursors; j++) {
+    if (E.cursors[j].cx == E.cx && E.cursors[j].cy == E.cy) {
+      break;
+    }
+  }
+  if (j == E.num_cursors) {
+    if (E.num_cursors == E.cursor_cap) {
+      E.cursor_cap = E.cursor_cap ? E.cursor_cap * 2 : 16;
+      E.cursors = realloc(E.cursors, sizeof(cursor) * E.cursor_cap);
+    }
+    E.cursors[E.num_cursors++] = (cursor){E.cx, E.cy};
+  }
+  editor_move_cursor('j');
+  editor_set_status_message("%d cursors (Esc to clear)", E.num_cursors + 1);
+}
+
+// Anchors a block at the cursor, which then spans to wherever the cursor
+// goes. Typing goes down its left edge, on every line that reaches it.
+void editor_toggle_block(void) {
+  E.block = !E.block;
+  if (E.block) {
+    E.block_cy = E.cy;
+    E.block_rx = editor_cursor_rx();
+    editor_set_status_message("Block from line %d (Esc to clear)", E.cy + 1);
+  } else {
+    editor_set_status_message("Block cleared");
+  }
+}
+
+// Pulls the cursors and the block back inside the buffer, for a view whose
+// rows were shrunk or removed by another client's replace or filter
+void editor_clamp_cursors(void) {
+  int j;
+  if (E.cy > E.buf->num_rows) {
+    E.cy = E.buf->num_rows;
+  }
+  editor_clamp_cx();
+  for (j = 0; j < E.num_cursors; j++) {
+    cursor *cur = &E.cursors[j];
+    if (cur->cy >= E.buf->num_rows) {
+      cur->cy = E.buf->num_rows;
+      cur->cx = 0;
+    } else if (cur->cx > editor_row(E.buf, cur->cy)->size) {
+      cur->cx = editor_row(E.buf, cur->cy)->size;
+    }
+  }
+  if (E.block_cy > E.buf->num_rows) {
+    E.block_cy = E.buf->num_rows;
   }
 }
 
+void editor_clear_cursors(void) {
+  if (E.num_cursors || E.block) {
+    E.num_cursors = 0;
+    E.block = 0;
+    E.redraw = 1;
+  }
+}
+
+// Types c at every cursor at once. The positions are sorted so each row is
+// rebuilt and re-rendered once for all the inserts that land on it, then
+// every cursor moves past what went in before it on its row.
+void editor_multi_insert(int c) {
+  int rx = editor_cursor_rx();
+  int top = E.cy, bottom = E.cy, left = rx, n = 0, j, k;
+  if (E.block) {
+    top = E.block_cy < E.cy ? E.block_cy : E.cy;
+    bottom = E.block_cy < E.cy ? E.cy : E.block_cy;
+    left = E.block_rx < rx ? E.block_rx : rx;
+  }
+  cursor *at = malloc(sizeof(cursor) * (bottom - top + 1 + E.num_cursors));
+  if (!E.block) {
+    at[n++] = (cursor){E.cx, E.cy};
+  }
+  for (j = top; E.block && j <= bottom && j < E.buf->num_rows; j++) {
+    erow *row = editor_row(E.buf, j);
+    int cx = editor_row_rx_to_cx(row, left);
+    if (cx < row->size || editor_row_conversion(row, cx) == left) {
+      at[n++] = (cursor){cx, j};
+    }
+  }
+  // Rows may have shrunk or gone under a cursor since it was placed
+  editor_clamp_cursors();
+  for (j = 0; j < E.num_cursors; j++) {
+    at[n++] = E.cursors[j];
+  }
+
+  qsort(at, n, sizeof(cursor), cursor_cmp);
+  for (j = k = 0; j < n; j++) {
+    if (k == 0 || cursor_cmp(&at[j], &at[k - 1]) != 0) {
+      at[k++] = at[j];
+    }
+  }
+  n = k;
+  if (n > 0 && at[n - 1].cy == E.buf->num_rows) {
+    editor_append_row(E.buf, "", 0);
+  }
+
+  int *cols = malloc(sizeof(int) * n);
+  for (j = 0; j < n; j = k) {
+    for (k = j; k < n && at[k].cy == at[j].cy; k++) {
+      cols[k - j] = at[k].cx;
+    }
+    editor_row_insert_chars(E.buf, editor_row(E.buf, at[j].cy), cols, k - j,
+                            c);
+  }
+  free(cols);
+
+  for (j = 0; j < E.num_cursors; j++) {
+    cursor *cur = &E.cursors[j];
+    cur->cx += cursor_rank(at, n, cur->cx, cur->cy) -
+               cursor_rank(at, n, INT_MAX, cur->cy - 1);
+  }
+  E.cx += cursor_rank(at, n, E.cx, E.cy) -
+          cursor_rank(at, n, INT_MAX, E.cy - 1);
+  if (E.block && n > 0) {
+    E.block_rx += c == '\t' ? TAB_STOP - left % TAB_STOP : 1;
+  }
+  free(at);
+}
+
+// SEARCH AND REPLACE //
+
+typedef struct ReplaceJob {
+  ebuffer *buf;
+  int first;
+  int num_rows;
+  const char *find;
+  size_t find_len;
+  const char *with;
+  size_t with_len;
+  regex_t *re;   // NULL for a literal search
+  long matches;  // out
+  long changed;  // out, rows rewritten
+  long long chars_delta;  // out, change in allocator bytes behind chars
+  long long render_delta; // out, same for render
+  char *scratch;          // copy of a row not loaded yet, for regexec
+  size_t scratch_cap;
+  dirty_row *edits; // out, rows changed and the bytes they held before
+  int num_edits;
+  int edits_cap;
+} replace_job;
+
+// Finds the next match in [text, end) at or after from, returns its start or
+// NULL
+static const char *replace_next_match(replace_job *job, const char *text,
+                                      const char *end, const char *from,
+                                      size_t *len) {
+  if (job->re) {
+    regmatch_t m;
+    int flags = from == text ? 0 : REG_NOTBOL;
+    if (from > end || regexec(job->re, from, 1, &m, flags) != 0) {
+      return NULL;
+    }
+    *len = m.rm_eo - m.rm_so;
+    return from + m.rm_so;
+  }
+  *len = job->find_len;
+  return memmem(from, end - from, job->find, job->find_len);
+}
+
+// Rewrites every matching row in the job's range. Each row's chars are
+// rebuilt in a single pass and its render is left to be redrawn lazily, so
+// ranges can run on separate threads without touching shared state. Rows
+// still in the file map are searched there and only loaded if they match.
+void *editor_replace_worker(void *arg) {
+  replace_job *job = arg;
+  int j;
+  for (j = job->first; j < job->first + job->num_rows; j++) {
+    int size;
+    const char *text = editor_row_text(job->buf, j, &size);
+    erow *row = &job->buf->row[j];
+    if (job->re && row->chars == NULL) {
+      // regexec wants a string, and rows in the map don't end in one
+      if ((size_t)size + 1 > job->scratch_cap) {
+        job->scratch_cap = (size_t)size * 2 + 1;
+        job->scratch = realloc(job->scratch, job->scratch_cap);
+      }
+      memcpy(job->scratch, text, size);
+      job->scratch[size] = '\0';
+      text = job->scratch;
+    }
+    const char *end = text + size;
+    size_t len;
+    const char *hit = replace_next_match(job, text, end, text, &len);
+    if (hit == NULL) {
+      continue;
+    }
+
+    // A literal that doesn't grow the row is rewritten in place, the write
+    // position never overtaking the read position
+    if (job->num_edits == job->edits_cap) {
+      job->edits_cap = job->edits_cap ? job->edits_cap * 2 : 64;
+      job->edits = realloc(job->edits, sizeof(dirty_row) * job->edits_cap);
+    }
+    job->edits[job->num_edits++] = (dirty_row){j, size, row->off};
+
+    int in_place = row->chars && job->re == NULL &&
+                   job->with_len <= job->find_len;
+    size_t cap = size + 1, out_len = 0;
+    char *out = in_place ? row->chars : malloc(cap);
+    const char *p = text;
+    while (hit) {
+      // Room for everything up to here plus the rest of the row unmatched
+      size_t need = out_len + (end - p) - len + job->with_len + 1;
+      if (need > cap) {
+        cap = need * 2;
+        out = realloc(out, cap);
+      }
+      memmove(&out[out_len], p, hit - p);
+      out_len += hit - p;
+      memcpy(&out[out_len], job->with, job->with_len);
+      out_len += job->with_len;
+      p = hit + len;
+      job->matches++;
+      if (len == 0) {
+        // An empty regex match would otherwise never advance
+        if (p == end) {
+          break;
+        }
+        out[out_len++] = *p++;
+        hit = replace_next_match(job, text, end, p, &len);
+      } else {
+        // Like sed, an empty match right after a real one doesn't count
+        hit = replace_next_match(job, text, end, p, &len);
+        if (hit == p && len == 0) {
+          hit = p == end ? NULL
+                         : replace_next_match(job, text, end, p + 1, &len);
+        }
+      }
+    }
+    memmove(&out[out_len], p, end - p);
+    out_len += end - p;
+    out[out_len] = '\0';
+
+    if (!in_place) {
+      job->chars_delta += (long long)mem_size(out) - mem_size(row->chars);
+      free(row->chars);
+      row->chars = out;
+    }
+    row->size = out_len;
+    job->render_delta -= mem_size(row->render);
+    free(row->render);
+    row->render = NULL;
+    job->changed++;
+  }
+  free(job->scratch);
+  return NULL;
+}
+
+// Replaces every occurrence in the buffer, splitting the rows across threads.
+// A pattern written as /.../ is a POSIX extended regex.
+void editor_replace_all(void) {
+  if (!editor_writable()) {
+    return;
+  }
+  char *find = editor_prompt("Replace (text or /regex/): %s", 0);
+  if (find == NULL) {
+    return;
+  }
+  // Nothing at all deletes the matches
+  char *with = editor_prompt("Replace with: %s", 1);
+  if (with == NULL) {
+    free(find);
+    return;
+  }
+
+  regex_t re;
+  int use_re = 0;
+  size_t find_len = strlen(find);
+  if (find_len > 2 && find[0] == '/' && find[find_len - 1] == '/') {
+    find[find_len - 1] = '\0';
+    int err = regcomp(&re, &find[1], REG_EXTENDED);
+    if (err != 0) {
+      char msg[64];
+      regerror(err, &re, msg, sizeof(msg));
+      editor_set_status_message("Bad regex: %s", msg);
+      free(find);
+      free(with);
+      return;
+    }
+    use_re = 1;
+  }
+
+  long long start = now_ms();
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int threads = E.buf->num_rows / REPLACE_MIN_ROWS;
+  if (threads > cpus) {
+    threads = cpus;
+  }
+  if (threads > REPLACE_MAX_THREADS) {
+    threads = REPLACE_MAX_THREADS;
+  }
+  if (threads < 1) {
+    threads = 1;
+  }
+
+  replace_job jobs[REPLACE_MAX_THREADS];
+  pthread_t tids[REPLACE_MAX_THREADS];
+  int per = E.buf->num_rows / threads, t;
+  for (t = 0; t < threads; t++) {
+    int first = t * per;
+    jobs[t] = (replace_job){E.buf,
+                            first,
+                            t == threads - 1 ? E.buf->num_rows - first : per,
+                            find,
+                            find_len,
+                            with,
+                            strlen(with),
+                            use_re ? &re : NULL,
+                            0,
+                            0,
+                            0,
+                            0,
+                            NULL,
+                            0,
+                            NULL,
+                            0,
+                            0};
+  }
+  // The calling thread takes the first range itself
+  for (t = 1; t < threads; t++) {
+    if (pthread_create(&tids[t], NULL, editor_replace_worker, &jobs[t]) != 0) {
+      editor_replace_worker(&jobs[t]);
+      tids[t] = 0;
+    }
+  }
+  editor_replace_worker(&jobs[0]);
+
+  long matches = 0, changed = 0;
+  for (t = 0; t < threads; t++) {
+    if (t > 0 && tids[t]) {
+      pthread_join(tids[t], NULL);
+    }
+    matches += jobs[t].matches;
+    changed += jobs[t].changed;
+    E.buf->mem_chars += jobs[t].chars_delta;
+    E.buf->mem_render += jobs[t].render_delta;
+    int k;
+    for (k = 0; k < jobs[t].num_edits; k++) {
+      dirty_row *d = &jobs[t].edits[k];
+      editor_row_modified(E.buf, d->row, d->len);
+      editor_pos_add(E.buf, d->row, E.buf->row[d->row].size - d->len);
+    }
+    free(jobs[t].edits);
+  }
+
+  if (use_re) {
+    regfree(&re);
+  }
+  free(find);
+  free(with);
+  if (E.cy < E.buf->num_rows && E.cx > editor_row(E.buf, E.cy)->size) {
+    E.cx = editor_row(E.buf, E.cy)->size;
+  }
+  editor_set_status_message("Replaced %ld matches on %ld lines in %lld ms",
+                            matches, changed, now_ms() - start);
+}
+
+// FILTER //
+
+// Pipes a range of rows through a shell command and puts its output in their
+// place, like vim's :%!. Rows are fed to the child while its output is split
+// into rows, so neither side is ever held as one big string. There is no
+// undo, so if the command fails the rows stay as they were and the start of
+// what it said on stderr is shown instead.
+void editor_filter(void) {
+  if (!editor_writable()) {
+    return;
+  }
+  char *spec = editor_prompt("Filter (%%!cmd, N,M!cmd or !cmd): %s", 0);
+  if (spec == NULL) {
+    return;
+  }
+  char *bang = strchr(spec, '!');
+  if (bang == NULL || bang[1] == '\0') {
+    editor_set_status_message("Usage: %%!cmd, N,M!cmd or !cmd");
+    free(spec);
+    return;
+  }
+  *bang = '\0';
+  const char *cmd = bang + 1;
+
+  int first = E.cy, last = E.cy;
+  if (strcmp(spec, "%") == 0) {
+    first = 0;
+    last = E.buf->num_rows - 1;
+  } else if (spec[0]) {
+    int len = 0;
+    int got = sscanf(spec, "%d%n,%d%n", &first, &len, &last, &len);
+    if (got < 1 || spec[len] != '\0') {
+      editor_set_status_message("Bad range \"%.20s\"", spec);
+      free(spec);
+      return;
+    }
+    if (got == 1) {
+      last = first;
+    }
+    first--;
+    last--;
+  }
+  if (first < 0) {
+    first = 0;
+  }
+  if (last >= E.buf->num_rows) {
+    last = E.buf->num_rows - 1;
+  }
+  if (first > E.buf->num_rows) {
+    first = E.buf->num_rows;
+  }
+  // N,N-1 is the empty range before line N, for inserting output
+  if (first > last + 1) {
+    editor_set_status_message("Range ends before it starts");
+    free(spec);
+    return;
+  }
+
+  int in[2], out[2], err[2];
+  if (pipe(in) == -1) {
+    editor_set_status_message("Can't filter: %s", strerror(errno));
+    free(spec);
+    return;
+  }
+  if (pipe(out) == -1) {
+    editor_set_status_message("Can't filter: %s", strerror(errno));
+    close(in[0]);
+    close(in[1]);
+    free(spec);
+    return;
+  }
+  if (pipe(err) == -1) {
+    editor_set_status_message("Can't filter: %s", strerror(errno));
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    free(spec);
+    return;
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(in[0], STDIN_FILENO);
+    dup2(out[1], STDOUT_FILENO);
+    dup2(err[1], STDERR_FILENO);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    close(err[0]);
+    close(err[1]);
+    execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+    _exit(127);
+  }
+  close(in[0]);
+  close(out[1]);
+  close(err[1]);
+  if (pid == -1) {
+    editor_set_status_message("Can't filter: %s", strerror(errno));
+    close(in[1]);
+    close(out[0]);
+    close(err[0]);
+    free(spec);
+    return;
+  }
+  fcntl(in[1], F_SETFL, fcntl(in[1], F_GETFL) | O_NONBLOCK);
+  fcntl(out[0], F_SETFL, fcntl(out[0], F_GETFL) | O_NONBLOCK);
+  fcntl(err[0], F_SETFL, fcntl(err[0], F_GETFL) | O_NONBLOCK);
+
+  // Output rows skip render until they are drawn
+  ebuffer result;
+  memset(&result, 0, sizeof(result));
+  result.batch = 1;
+  char *chunk = malloc(INGEST_CHUNK);
+  char errmsg[64]; // the start of stderr, the rest is drained and dropped
+  size_t err_len = 0;
+  int row = first;
+  size_t off = 0;
+  if (row > last) {
+    close(in[1]);
+    in[1] = -1;
+  }
+
+  // Closed descriptors are -1, which poll() skips
+  while (out[0] != -1 || err[0] != -1) {
+    struct pollfd pfd[3] = {
+        {out[0], POLLIN, 0}, {in[1], POLLOUT, 0}, {err[0], POLLIN, 0}};
+    if (poll(pfd, 3, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    if (in[1] != -1 && pfd[1].revents) {
+      ssize_t n = editor_write_rows(E.buf, in[1], &row, last, &off);
+      // EPIPE just means the command stopped reading, as head does
+      if (row > last || (n == -1 && errno != EAGAIN && errno != EINTR)) {
+        close(in[1]);
+        in[1] = -1;
+      }
+    }
+    if (pfd[0].revents) {
+      ssize_t n = read(out[0], chunk, INGEST_CHUNK);
+      if (n > 0) {
+        editor_ingest(&result, chunk, n);
+      } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        close(out[0]);
+        out[0] = -1;
+      }
+    }
+    if (pfd[2].revents) {
+      size_t room = sizeof(errmsg) - 1 - err_len;
+      ssize_t n = room ? read(err[0], &errmsg[err_len], room)
+                       : read(err[0], chunk, INGEST_CHUNK);
+      if (n > 0) {
+        err_len += room ? n : 0;
+      } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        close(err[0]);
+        err[0] = -1;
+      }
+    }
+  }
+  if (in[1] != -1) {
+    close(in[1]);
+  }
+  if (out[0] != -1) {
+    close(out[0]);
+  }
+  if (err[0] != -1) {
+    close(err[0]);
+  }
+  free(chunk);
+
+  int status = 0;
+  waitpid(pid, &status, 0);
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    editor_free_rows(&result);
+    free(result.row);
+    free(result.pos_tree);
+    errmsg[err_len] = '\0';
+    errmsg[strcspn(errmsg, "\n")] = '\0';
+    editor_set_status_message("Filter failed, rows kept: %s",
+                              err_len ? errmsg : "no output on stderr");
+    free(spec);
+    return;
+  }
+
+  int lines_in = last - first + 1, lines_out = result.num_rows;
+  editor_replace_rows(E.buf, first, lines_in, &result);
+  free(result.row);
+  E.cy = first;
+  E.cx = 0;
+  editor_set_status_message("%d lines filtered through \"%.20s\", %d out",
+                            lines_in, cmd, lines_out);
+  free(spec);
+}
+
+// MACROS //
+
+void editor_toggle_recording(void) {
+  if (E.recording) {
+    E.recording = 0;
+    E.macro_len--; // Drop the Ctrl-T that stopped the recording
+    editor_set_status_message("Recorded %d keys", E.macro_len);
+  } else {
+    E.recording = 1;
+    E.macro_len = 0;
+    editor_set_status_message("Recording macro (Ctrl-T to stop)");
+  }
+}
+
+// Feeds the macro through the normal key handling without drawing, either
+// count times from the cursor or once at the start of every line
+void editor_replay_macro(void) {
+  if (E.recording) {
+    E.macro_len--;
+    editor_set_status_message("Can't replay while recording");
+    return;
+  }
+  if (E.macro_len == 0) {
+    editor_set_status_message("No macro recorded (Ctrl-T to record)");
+    return;
+  }
+
+  char *arg =
+      editor_prompt("Replay macro (count, or %% for every line): %s", 0);
+  if (arg == NULL) {
+    return;
+  }
+  int per_line = strcmp(arg, "%") == 0;
+  long count = per_line ? E.buf->num_rows : strtol(arg, NULL, 10);
+  free(arg);
+  if (count <= 0) {
+    editor_set_status_message("Invalid count");
+    return;
+  }
+
+  long long start = now_ms();
+  long i;
+  E.buf->batch = 1;
+  for (i = 0; i < count; i++) {
+    if (per_line) {
+      if (i >= E.buf->num_rows) {
+        break;
+      }
+      E.cy = i;
+      E.cx = 0;
+    }
+    E.replay_pos = 0;
+    while (E.replay_pos < E.macro_len) {
+      editor_process_keypress();
+    }
+  }
+  E.replay_pos = -1;
+  E.buf->batch = 0;
+  editor_set_status_message("Replayed %ld times in %lld ms", i,
+                            now_ms() - start);
+}
+
 // Takes in keystrokes and handles any specific keystroke cases
 void editor_process_keypress(void) {
   char c = editor_read_key();
@@ -513,10 +2103,51 @@ void editor_process_keypress(void) {
   case '\r':
     break;
 
+  case CTRL_KEY('f'):
+    editor_toggle_follow();
+    break;
+
+  case CTRL_KEY('r'):
+    editor_replace_all();
+    break;
+
+  case CTRL_KEY('p'):
+    editor_filter();
+    break;
+
+  case CTRL_KEY('w'):
+    editor_toggle_mem_status();
+    break;
+
+  case CTRL_KEY('u'): // Page Up
+  case CTRL_KEY('d'): // Page Down
+    editor_page(c == CTRL_KEY('d') ? 1 : -1);
+    break;
+
+  case CTRL_KEY('g'):
+    editor_goto();
+    break;
+
+  case CTRL_KEY('t'):
+    if (E.replay_pos < 0) {
+      editor_toggle_recording();
+    }
+    break;
+
+  case CTRL_KEY('e'):
+    if (E.replay_pos < 0) {
+      editor_replay_macro();
+    }
+    break;
+
   // Keystroke to close program
   case CTRL_KEY('q'):
-    write(STDOUT_FILENO, "\x1b[2J", 4); // Clear the screen
-    write(STDOUT_FILENO, "\x1b[H", 3);  // Position the cursor at the top left
+    write(E.out_fd, "\x1b[2J", 4); // Clear the screen
+    write(E.out_fd, "\x1b[H", 3);  // Position the cursor at the top left
+    if (E.client) {
+      E.detached = 1; // The server and the buffer stay up
+      break;
+    }
     exit(0);
     break;
   case 'h':
@@ -530,8 +2161,20 @@ void editor_process_keypress(void) {
   case CTRL_KEY('h'):
     break;
 
-  case CTRL_KEY('l'):
+  case CTRL_KEY('n'):
+    editor_add_cursor();
+    break;
+
+  case CTRL_KEY('b'):
+    editor_toggle_block();
+    break;
+
   case '\x1b':
+    editor_clear_cursors();
+    break;
+
+  case CTRL_KEY('l'):
+  case NO_KEY:
     break;
 
   default:
@@ -548,28 +2191,461 @@ void initEditor(void) {
   E.rx = 0;
   E.row_off = 0;
   E.col_off = 0;
-  E.num_rows = 0;
-  E.row = NULL;
+  E.buf = calloc(1, sizeof(ebuffer));
   E.file = NULL;
+  E.src_fd = -1;
+  E.src_off = 0;
+  E.follow = 0;
+  E.streaming = 0;
+  E.redraw = 1;
+  E.last_refresh = 0;
+  E.macro = NULL;
+  E.macro_len = 0;
+  E.macro_cap = 0;
+  E.recording = 0;
+  E.replay_pos = -1;
+  E.cursors = NULL;
+  E.num_cursors = 0;
+  E.cursor_cap = 0;
+  E.block = 0;
+  E.frame = NULL;
+  E.frame_row_off = 0;
+  E.mem_frame = 0;
+  E.mem_render_floor = 0;
+  E.mem_status = 0;
+  E.mem_budget = 0;
+  // Budget in bytes, with an optional K, M or G suffix
+  char *budget = getenv("QUILL_MEM_BUDGET");
+  if (budget) {
+    char *unit;
+    E.mem_budget = strtoull(budget, &unit, 10);
+    switch (toupper((unsigned char)*unit)) {
+    case 'G':
+      E.mem_budget <<= 10;
+      /* fall through */
+    case 'M':
+      E.mem_budget <<= 10;
+      /* fall through */
+    case 'K':
+      E.mem_budget <<= 10;
+    }
+  }
+  E.mem_report = getenv("QUILL_MEM_REPORT");
+  if (E.mem_report) {
+    atexit(editor_mem_dump);
+  }
   E.statusmsg[0] = '\0';
   E.statusmsg_time = 0;
-  if (get_window_size(&E.screen_rows, &E.screen_cols) == -1) {
+  E.out_fd = STDOUT_FILENO;
+  E.client = 0;
+  E.detached = 0;
+}
+
+// Waits for a keypress, waking up early when piped input arrives, a followed
+// file needs polling or a throttled redraw is due. Returns 1 if a key is ready.
+int editor_wait_key(void) {
+  int timeout = -1;
+  if (E.follow) {
+    timeout = FRAME_BUDGET_MS;
+  }
+  if (E.redraw) {
+    long long due = E.last_refresh + FRAME_BUDGET_MS - now_ms();
+    if (due < 0) {
+      due = 0;
+    }
+    if (timeout == -1 || due < timeout) {
+      timeout = due;
+    }
+  }
+
+  struct pollfd pfd[2] = {{E.tty_fd, POLLIN, 0}, {E.src_fd, POLLIN, 0}};
+  int n = poll(pfd, E.streaming ? 2 : 1, timeout);
+  if (n == -1 && errno != EINTR) {
+    die("poll");
+  }
+  if (n > 0 && E.streaming && pfd[1].revents) {
+    editor_stream_poll();
+  }
+  return n > 0 && (pfd[0].revents & POLLIN);
+}
+
+// SERVER //
+
+econfig views[SERVER_MAX_CLIENTS]; // one per attached client
+int num_views = 0;
+econfig *docs = NULL; // each buffer the server holds, as first opened
+int num_docs = 0;
+
+// $XDG_RUNTIME_DIR/quill.sock, or in a directory of our own in /tmp
+void editor_socket_path(struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  const char *dir = getenv("XDG_RUNTIME_DIR");
+  if (dir && dir[0]) {
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/quill.sock", dir);
+  } else {
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "/tmp/quill-%d/quill.sock",
+             (int)getuid());
+  }
+}
+
+// Creates the directory the socket goes in if need be, and makes sure only
+// we can get into it. Returns 0 if it is anyone else's or open to them.
+int editor_socket_dir(struct sockaddr_un *addr) {
+  char *slash = strrchr(addr->sun_path, '/');
+  *slash = '\0';
+  mkdir(addr->sun_path, 0700);
+  struct stat st;
+  int ok = lstat(addr->sun_path, &st) == 0 && S_ISDIR(st.st_mode) &&
+           st.st_uid == getuid() && (st.st_mode & 077) == 0;
+  if (!ok) {
+    fprintf(stderr, "quill: %s must be a directory only you can access\n",
+            addr->sun_path);
+  }
+  *slash = '/';
+  return ok;
+}
+
+// 1 if whoever is at the other end of a Unix socket runs as us, so neither
+// keys nor files go to or come from another user
+int peer_is_us(int fd) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+         cred.uid == getuid();
+}
+
+// Writes all of s, as terminals and sockets may take it in pieces
+void write_all(int fd, const char *s, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, s, len);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return;
+    }
+    s += n;
+    len -= n;
+  }
+}
+
+// Makes a view of path for a new client the current editor, sharing the
+// buffer if it is already loaded. Returns 0 if it isn't a regular file that
+// can be read; anything else would hang or kill the server and with it
+// every client's buffer.
+int server_open(const char *path, const econfig *blank) {
+  int j;
+  for (j = 0; j < num_docs; j++) {
+    if (strcmp(docs[j].file, path) == 0) {
+      E = docs[j];
+      return 1;
+    }
+  }
+  // Without O_NONBLOCK a FIFO wouldn't even let open() return
+  struct stat st;
+  int fd = open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+  if (fd == -1) {
+    return 0;
+  }
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return 0;
+  }
+  E = *blank;
+  E.buf = calloc(1, sizeof(ebuffer));
+  if (editor_open_fd((char *)path, fd) == -1) {
+    editor_free_rows(E.buf);
+    free(E.buf->row);
+    free(E.buf->dirty);
+    free(E.buf->pos_tree);
+    free(E.buf->index_file);
+    free(E.buf);
+    free(E.file);
+    return 0;
+  }
+  docs = realloc(docs, sizeof(econfig) * (num_docs + 1));
+  docs[num_docs++] = E;
+  return 1;
+}
+
+// Takes a client's "rows cols sync path" greeting and gives it a view
+void server_accept(int lfd, const econfig *blank) {
+  int fd = accept(lfd, NULL, NULL);
+  if (fd == -1) {
+    return;
+  }
+  if (!peer_is_us(fd)) {
+    close(fd);
+    return;
+  }
+  // Reads time out like the terminal's VTIME, so a lone Escape still works
+  struct timeval tv = {0, 100000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  char hello[4096 + 64];
+  size_t len = 0;
+  while (len < sizeof(hello) - 1 && read(fd, &hello[len], 1) == 1 &&
+         hello[len] != '\n') {
+    len++;
+  }
+  hello[len] = '\0';
+  int rows, cols, sync, n = 0;
+  if (num_views == SERVER_MAX_CLIENTS ||
+      sscanf(hello, "%d %d %d %n", &rows, &cols, &sync, &n) != 3 || n == 0 ||
+      rows < 3 || cols < 1) {
+    close(fd);
+    return;
+  }
+  if (!server_open(&hello[n], blank)) {
+    char msg[128];
+    snprintf(msg, sizeof(msg), "quill: can't open %.80s\r\n", &hello[n]);
+    write_all(fd, msg, strlen(msg));
+    close(fd);
+    return;
+  }
+
+  E.tty_fd = E.out_fd = fd;
+  E.client = 1;
+  E.detached = 0;
+  E.screen_rows = rows - 2;
+  E.screen_cols = cols;
+  E.sync_output = sync;
+  E.frame = NULL;
+  E.macro = NULL;
+  E.macro_len = E.macro_cap = 0;
+  E.recording = 0;
+  E.replay_pos = -1;
+  E.cursors = NULL;
+  E.num_cursors = E.cursor_cap = 0;
+  E.block = 0;
+  E.mem_status = 0;
+  E.redraw = 1;
+  int sharing = 0, j;
+  for (j = 0; j < num_views; j++) {
+    sharing += views[j].buf == E.buf;
+  }
+  editor_set_status_message("HELP: Ctrl-Q detach | %d other client%s here",
+                            sharing, sharing == 1 ? "" : "s");
+  editor_refresh_screen();
+  views[num_views++] = E;
+}
+
+void server_detach(int j) {
+  E = views[j];
+  editor_index_save_position();
+  close(E.tty_fd);
+  free(E.frame);
+  free(E.macro);
+  free(E.cursors);
+  views[j] = views[--num_views];
+}
+
+// Holds buffers for clients attached over a Unix socket, each with its own
+// cursor and screen. Keys are handled one client at a time by swapping its
+// view into E, so a client in a prompt holds the others up until it's done.
+void editor_serve(void) {
+  struct sockaddr_un addr;
+  editor_socket_path(&addr);
+  if (!editor_socket_dir(&addr)) {
+    exit(1);
+  }
+  int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (lfd == -1) {
+    die("socket");
+  }
+  if (connect(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+    fprintf(stderr, "quill: a server is already listening on %s\n",
+            addr.sun_path);
+    exit(1);
+  }
+  close(lfd);
+  unlink(addr.sun_path); // Left behind by a server that died
+  lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  mode_t mask = umask(077); // Whatever the umask, the socket is ours alone
+  int bound = lfd != -1 &&
+              bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+  umask(mask);
+  if (!bound || listen(lfd, 16) == -1) {
+    perror(addr.sun_path);
+    exit(1);
+  }
+  fprintf(stderr, "quill: serving on %s\n", addr.sun_path);
+
+  initEditor();
+  econfig blank = E;
+  while (1) {
+    struct pollfd pfd[SERVER_MAX_CLIENTS + 1];
+    int j, k;
+    pfd[0] = (struct pollfd){lfd, POLLIN, 0};
+    for (j = 0; j < num_views; j++) {
+      pfd[j + 1] = (struct pollfd){views[j].tty_fd, POLLIN, 0};
+    }
+    if (poll(pfd, num_views + 1, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      die("poll");
+    }
+
+    // Backwards, so a detach only moves a view that was already handled
+    for (j = num_views - 1; j >= 0; j--) {
+      if (pfd[j + 1].revents == 0) {
+        continue;
+      }
+      E = views[j];
+      ebuffer *buf = E.buf;
+      editor_process_keypress();
+      editor_mem_enforce_budget();
+      if (!E.detached) {
+        editor_refresh_screen();
+      }
+      views[j] = E;
+      if (E.detached) {
+        server_detach(j);
+      }
+      // Everyone else looking at the buffer sees the change
+      for (k = 0; k < num_views; k++) {
+        if (k != j && views[k].buf == buf) {
+          E = views[k];
+          editor_clamp_cursors();
+          editor_refresh_screen();
+          views[k] = E;
+        }
+      }
+    }
+    if (pfd[0].revents) {
+      server_accept(lfd, &blank);
+    }
+  }
+}
+
+// Hands this terminal to a running server: keys go up the socket and frames
+// come back down. Returns only if there is no server to attach to.
+void editor_attach(const char *filename) {
+  struct sockaddr_un addr;
+  editor_socket_path(&addr);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  char *path = realpath(filename, NULL);
+  if (fd == -1 || path == NULL ||
+      connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    if (fd != -1) {
+      close(fd);
+    }
+    free(path);
+    return;
+  }
+  if (!peer_is_us(fd)) {
+    fprintf(stderr, "quill: %s is run by another user, not attaching\n",
+            addr.sun_path);
+    exit(1);
+  }
+
+  enable_raw_mode();
+  int rows, cols;
+  if (get_window_size(&rows, &cols) == -1) {
     die("get_window_size");
   }
-  E.screen_rows -= 2;
+  dprintf(fd, "%d %d %d %s\n", rows, cols, detect_sync_output(), path);
+  free(path);
+
+  static char buf[INGEST_CHUNK];
+  struct pollfd pfd[2] = {{STDIN_FILENO, POLLIN, 0}, {fd, POLLIN, 0}};
+  while (1) {
+    if (poll(pfd, 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      die("poll");
+    }
+    if (pfd[0].revents) {
+      ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+      if (n > 0) {
+        write_all(fd, buf, n);
+      }
+    }
+    if (pfd[1].revents) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n <= 0) {
+        break; // Detached
+      }
+      write_all(STDOUT_FILENO, buf, n);
+    }
+  }
+  exit(0);
 }
 
 int main(int argc, char *argv[]) {
+  char *filename = NULL;
+  int follow = 0, serve = 0, attach = 0;
+  int j;
+  for (j = 1; j < argc; j++) {
+    if (strcmp(argv[j], "+F") == 0) {
+      follow = 1;
+    } else if (strcmp(argv[j], "--server") == 0) {
+      serve = 1;
+    } else if (strcmp(argv[j], "-c") == 0) {
+      attach = 1;
+    } else {
+      filename = argv[j];
+    }
+  }
+
+  // Filters and clients may go away before reading all we write them
+  signal(SIGPIPE, SIG_IGN);
+  if (serve) {
+    editor_serve();
+  }
+
+  // With the buffer on stdin, keys have to come from the terminal itself
+  E.tty_fd = STDIN_FILENO;
+  if (filename && strcmp(filename, "-") == 0) {
+    E.tty_fd = open("/dev/tty", O_RDWR);
+    if (E.tty_fd == -1) {
+      perror("/dev/tty");
+      exit(1);
+    }
+  } else if (attach && filename && !follow) {
+    editor_attach(filename); // Runs on its own if no server is up
+  }
   enable_raw_mode();
   initEditor();
-  if (argc >= 2) {
-    editor_open(argv[1]);
+  if (get_window_size(&E.screen_rows, &E.screen_cols) == -1) {
+    die("get_window_size");
+  }
+  E.screen_rows -= 2;
+  E.sync_output = detect_sync_output();
+  E.follow = follow;
+
+  if (E.tty_fd != STDIN_FILENO) {
+    E.follow = 0;
+    editor_open_stdin();
+  } else if (filename) {
+    editor_open(filename);
+    if (E.buf->index_file) {
+      atexit(editor_index_save_position);
+    }
+    if (E.follow && E.buf->num_rows > 0) {
+      E.cy = E.buf->num_rows - 1; // Like less +F, start at the bottom
+    }
+  } else {
+    E.follow = 0;
   }
 
-  editor_set_status_message("HELP: Ctrl-S to save | Ctrl-Q to quit");
+  editor_set_status_message(
+      "HELP: Ctrl-S save | Ctrl-Q quit | Ctrl-F follow | Ctrl-R replace | "
+      "Ctrl-G go to");
+  editor_refresh_screen();
   while (1) {
-    editor_refresh_screen();
-    editor_process_keypress();
+    if (editor_wait_key()) {
+      editor_process_keypress();
+      editor_refresh_screen();
+    }
+    editor_follow_poll();
+    editor_mem_enforce_budget();
+    if (E.redraw && now_ms() - E.last_refresh >= FRAME_BUDGET_MS) {
+      editor_refresh_screen();
+    }
   }
 
   return 0;
@@ -0,0 +1,857 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <malloc.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "row.h"
+
+#define ROWS_IOV 1024 // iovecs handed to one writev
+
+static void editor_pos_grow(ebuffer *buf);
+static void editor_map_unguard(ebuffer *buf);
+
+// ROW OPERATIONS//
+
+// What the allocator really reserved for p, slack included
+size_t mem_size(void *p) { return p ? malloc_usable_size(p) : 0; }
+
+// Puts a row the index hasn't been consulted for yet at its place in the map.
+// The row table starts out zeroed, so such a row has no chars, no size and no
+// offset, and sits below index_rows. Entries of a cached index are only
+// checked here, as rows are first looked at; one pointing outside the map
+// leaves the row empty and the index to be built again.
+static erow *editor_row_settle(ebuffer *buf, int at) {
+  erow *row = &buf->row[at];
+  if (row->chars || row->off || row->size || buf->index == NULL ||
+      at >= buf->index_rows) {
+    return row;
+  }
+  uint64_t start = buf->index[at], end = buf->index[at + 1];
+  if (start >= end || end > buf->map_len + 1) {
+    buf->index_bad = 1;
+    return row;
+  }
+  size_t len = end - start - 1;
+  if (buf->index_crs && (!buf->tail_open || at < buf->index_rows - 1)) {
+    // CRs before the newline are dropped as when reading the file
+    while (len > 0 && buf->map[start + len - 1] == '\r') {
+      len--;
+    }
+  }
+  row->off = start;
+  row->size = len;
+  return row;
+}
+
+// Row at, its chars read in from the map if they weren't yet
+erow *editor_row(ebuffer *buf, int at) {
+  erow *row = editor_row_settle(buf, at);
+  if (row->chars == NULL) {
+    row->chars = malloc(row->size + 1);
+    buf->mem_chars += mem_size(row->chars);
+    memcpy(row->chars, &buf->map[row->off], row->size);
+    if (buf->map_lost) {
+      // What was copied is zeros standing in for bytes that are gone
+      row->size = 0;
+    }
+    row->chars[row->size] = '\0';
+  }
+  return row;
+}
+
+// Row at's text without loading it, straight out of the map if need be. Only
+// that one row is touched, so threads can read disjoint rows at once.
+const char *editor_row_text(ebuffer *buf, int at, int *len) {
+  erow *row = editor_row_settle(buf, at);
+  *len = row->size;
+  return row->chars ? row->chars : &buf->map[row->off];
+}
+
+void editor_release_index(ebuffer *buf) {
+  if (buf->index_mapped) {
+    munmap(buf->index_mem, buf->index_len);
+  } else {
+    free(buf->index_mem);
+  }
+  buf->index = NULL;
+  buf->index_rows = 0;
+  buf->index_blocks = NULL;
+  buf->index_mem = NULL;
+  buf->index_len = 0;
+  buf->index_mapped = 0;
+}
+
+// MAP GUARD//
+
+static ebuffer *guarded; // buffers whose rows may still be read from a map
+
+// Touching a page of a map past the end of a file cut short since raises
+// SIGBUS. The map is swapped for zeros and its buffer marked, so whatever
+// was reading carries on and the editor catches up afterwards.
+static void editor_map_fault(int sig, siginfo_t *info, void *ctx) {
+  const char *at = info->si_addr;
+  ebuffer *buf;
+  (void)ctx;
+  for (buf = guarded; buf; buf = buf->guard_next) {
+    if (buf->map && at >= buf->map && at < buf->map + buf->map_len &&
+        mmap((void *)buf->map, buf->map_len, PROT_READ,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED) {
+      buf->map_lost = 1;
+      return;
+    }
+  }
+  // Not a map of ours, so the fault kills us as it would have
+  signal(sig, SIG_DFL);
+}
+
+// Watches the file buf's map was taken from for being cut short
+void editor_map_guard(ebuffer *buf) {
+  static int installed = 0;
+  ebuffer *b;
+  for (b = guarded; b; b = b->guard_next) {
+    if (b == buf) {
+      return;
+    }
+  }
+  if (!installed) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = editor_map_fault;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGBUS, &sa, NULL);
+    installed = 1;
+  }
+  buf->guard_next = guarded;
+  guarded = buf;
+}
+
+static void editor_map_unguard(ebuffer *buf) {
+  ebuffer **b;
+  for (b = &guarded; *b; b = &(*b)->guard_next) {
+    if (*b == buf) {
+      *b = buf->guard_next;
+      return;
+    }
+  }
+}
+
+// Catches up with a file cut short under the map. Rows not read in yet went
+// with it and are left empty, edits elsewhere are kept, and as the rows no
+// longer match the file it is all written out on the next save. Returns 1
+// if the map was lost.
+int editor_map_recover(ebuffer *buf) {
+  if (!buf->map_lost) {
+    return 0;
+  }
+  int j;
+  for (j = 0; j < buf->num_rows; j++) {
+    erow *row = &buf->row[j];
+    if (row->chars == NULL) {
+      row->size = 0;
+      row->chars = calloc(1, 1);
+      buf->mem_chars += mem_size(row->chars);
+    }
+  }
+  editor_release_index(buf);
+  editor_map_unguard(buf);
+  munmap((void *)buf->map, buf->map_len);
+  buf->map = NULL;
+  buf->map_len = 0;
+  buf->map_lost = 0;
+  buf->relayout = 1;
+  editor_pos_rebuild(buf);
+  return 1;
+}
+
+// Swaps the map rows are read from for the file every row was just written
+// out to in full, which settled them all
+void editor_remap_rows(ebuffer *buf, const char *map, size_t len) {
+  editor_release_index(buf);
+  if (buf->map) {
+    munmap((void *)buf->map, buf->map_len);
+  }
+  buf->map = map;
+  buf->map_len = len;
+  if (map) {
+    editor_map_guard(buf);
+  } else {
+    editor_map_unguard(buf);
+  }
+  long long off = 0;
+  int j;
+  for (j = 0; j < buf->num_rows; j++) {
+    buf->row[j].off = off;
+    buf->row[j].dirty = 0;
+    off += buf->row[j].size + 1;
+  }
+  buf->disk_rows = buf->num_rows;
+  buf->disk_len = len;
+  buf->num_dirty = 0;
+  buf->relayout = 0;
+  buf->tail_open = 0;
+}
+
+// Records row at as changed the first time it is, disk_len being the bytes
+// it held until now. Rows past disk_rows are new and go out with the tail.
+void editor_row_modified(ebuffer *buf, int at, int disk_len) {
+  erow *row = &buf->row[at];
+  if (row->dirty || at >= buf->disk_rows) {
+    return;
+  }
+  row->dirty = 1;
+  if (buf->num_dirty == buf->dirty_cap) {
+    buf->dirty_cap = buf->dirty_cap ? buf->dirty_cap * 2 : 64;
+    buf->dirty = realloc(buf->dirty, sizeof(dirty_row) * buf->dirty_cap);
+  }
+  buf->dirty[buf->num_dirty++] = (dirty_row){at, disk_len, row->off};
+}
+
+// Where the file has to be rewritten from once the dirty rows are back in
+// place, and the first row that goes there. -1 if rows moved, so all of the
+// file has to be written out again.
+long long editor_save_tail(ebuffer *buf, int *first) {
+  if (buf->relayout) {
+    return -1;
+  }
+  long long tail = buf->disk_len;
+  int j, len;
+  *first = buf->disk_rows;
+  if (buf->tail_open && buf->disk_rows > 0) {
+    // The last row gets the newline it lacks in the file
+    *first = buf->disk_rows - 1;
+    editor_row_text(buf, *first, &len);
+    tail = buf->row[*first].off;
+  }
+  for (j = 0; j < buf->num_dirty; j++) {
+    dirty_row *d = &buf->dirty[j];
+    if (buf->row[d->row].size == d->len) {
+      continue;
+    }
+    if (d->row != buf->disk_rows - 1) {
+      return -1;
+    }
+    // Only the last row may change length, it heads the tail
+    *first = d->row;
+    tail = d->off;
+  }
+  return tail;
+}
+
+static int dirty_cmp(const void *a, const void *b) {
+  long long x = ((const dirty_row *)a)->off, y = ((const dirty_row *)b)->off;
+  return (x > y) - (x < y);
+}
+
+// Writes the dirty rows that start before before back where they were, each
+// run of neighbouring rows in one pwritev. Returns bytes written or -1.
+long long editor_write_dirty(ebuffer *buf, int fd, long long before) {
+  struct iovec iov[ROWS_IOV];
+  long long total = 0, start = 0, end = 0;
+  int n = 0, j;
+  qsort(buf->dirty, buf->num_dirty, sizeof(dirty_row), dirty_cmp);
+  for (j = 0; j <= buf->num_dirty; j++) {
+    dirty_row *d = j < buf->num_dirty ? &buf->dirty[j] : NULL;
+    if (d && d->off >= before) {
+      d = NULL;
+    }
+    if (n > 0 && (d == NULL || d->off != end + 1 || n > ROWS_IOV - 2)) {
+      if (pwritev(fd, iov, n, start) != end - start) {
+        return -1;
+      }
+      total += end - start;
+      n = 0;
+    }
+    if (d == NULL) {
+      break;
+    }
+    if (n > 0) {
+      // The newline between two neighbours is already there, but writing
+      // it again keeps them in one run
+      iov[n].iov_base = (void *)"\n";
+      iov[n++].iov_len = 1;
+    } else {
+      start = d->off;
+    }
+    iov[n].iov_base = buf->row[d->row].chars;
+    iov[n++].iov_len = d->len;
+    end = d->off + d->len;
+  }
+  return total;
+}
+
+// Catches up with the file once the dirty rows are back in place and rows
+// from first on were written out from tail
+void editor_saved_in_place(ebuffer *buf, long long tail, int first) {
+  int j;
+  for (j = 0; j < buf->num_dirty; j++) {
+    buf->row[buf->dirty[j].row].dirty = 0;
+  }
+  buf->num_dirty = 0;
+  for (j = first; j < buf->num_rows; j++) {
+    buf->row[j].off = tail;
+    buf->row[j].dirty = 0;
+    tail += buf->row[j].size + 1;
+  }
+  buf->disk_rows = buf->num_rows;
+  buf->disk_len = tail;
+  buf->tail_open = 0;
+}
+
+int editor_row_conversion(erow *row, int cx) {
+  int rx = 0, j;
+  for (j = 0; j < cx; j++) {
+    if (row->chars[j] == '\t') {
+      rx += (TAB_STOP - 1) - (rx % TAB_STOP);
+    }
+    rx++;
+  }
+  return rx;
+}
+
+// The char drawn at render column rx, row->size if the row ends before it
+int editor_row_rx_to_cx(erow *row, int rx) {
+  int cur = 0, cx;
+  for (cx = 0; cx < row->size; cx++) {
+    if (row->chars[cx] == '\t') {
+      cur += (TAB_STOP - 1) - (cur % TAB_STOP);
+    }
+    if (++cur > rx) {
+      return cx;
+    }
+  }
+  return cx;
+}
+
+void editor_update_row(ebuffer *buf, erow *row) {
+  int tabs = 0;
+  int j, idx = 0;
+  for (j = 0; j < row->size; j++) {
+    if (row->chars[j] == '\t') {
+      tabs++;
+    }
+  }
+
+  buf->mem_render -= mem_size(row->render);
+  free(row->render);
+  row->render = malloc(row->size + tabs * (TAB_STOP - 1) + 1);
+  buf->mem_render += mem_size(row->render);
+
+  for (j = 0; j < row->size; j++) {
+    if (row->chars[j] == '\t') {
+      row->render[idx++] = ' ';
+      while (idx % TAB_STOP != 0) {
+        row->render[idx++] = ' ';
+      }
+    } else {
+      row->render[idx++] = row->chars[j];
+    }
+  }
+
+  row->render[idx] = '\0';
+  row->rsize = idx;
+}
+void editor_append_row(ebuffer *buf, const char *s, size_t len) {
+  // Growing geometrically keeps bulk ingestion linear in the row count
+  if (buf->num_rows == buf->row_cap) {
+    buf->row_cap = buf->row_cap ? buf->row_cap * 2 : 64;
+    buf->row = realloc(buf->row, sizeof(erow) * buf->row_cap);
+  }
+
+  int at = buf->num_rows;
+  if (at / POS_BLOCK == buf->pos_blocks) {
+    editor_pos_grow(buf);
+  }
+  buf->row[at].size = len;
+  buf->row[at].chars = malloc(len + 1);
+  buf->mem_chars += mem_size(buf->row[at].chars);
+  memcpy(buf->row[at].chars, s, len);
+  buf->row[at].chars[len] = '\0';
+
+  buf->row[at].rsize = 0;
+  buf->row[at].render = NULL;
+  buf->row[at].off = -1;
+  buf->row[at].dirty = 0;
+  if (!buf->batch) {
+    editor_update_row(buf, &buf->row[at]);
+  }
+
+  buf->num_rows++;
+  editor_pos_add(buf, at, len + 1);
+}
+
+// Frees render, it gets rebuilt from chars the next time the row is drawn
+void editor_row_drop_render(ebuffer *buf, erow *row) {
+  buf->mem_render -= mem_size(row->render);
+  free(row->render);
+  row->render = NULL;
+}
+
+void editor_row_insert_char(ebuffer *buf, erow *row, int at, int c) {
+  if (at < 0 || at > row->size)
+    at = row->size;
+  editor_row_modified(buf, row - buf->row, row->size);
+  editor_pos_add(buf, row - buf->row, 1);
+  buf->mem_chars -= mem_size(row->chars);
+  row->chars = realloc(row->chars, row->size + 2);
+  buf->mem_chars += mem_size(row->chars);
+  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+  row->size++;
+  row->chars[at] = c;
+  if (buf->batch) {
+    // Rebuilt once when the row is next drawn instead of once per key
+    editor_row_drop_render(buf, row);
+  } else {
+    editor_update_row(buf, row);
+  }
+}
+
+void editor_row_append_string(ebuffer *buf, erow *row, const char *s,
+                              size_t len) {
+  editor_row_modified(buf, row - buf->row, row->size);
+  editor_pos_add(buf, row - buf->row, len);
+  buf->mem_chars -= mem_size(row->chars);
+  row->chars = realloc(row->chars, row->size + len + 1);
+  buf->mem_chars += mem_size(row->chars);
+  memcpy(&row->chars[row->size], s, len);
+  row->size += len;
+  row->chars[row->size] = '\0';
+  editor_update_row(buf, row);
+}
+
+// Inserts c before each of count ascending positions in one pass, moving
+// every run of text between them once, for many cursors on one row
+void editor_row_insert_chars(ebuffer *buf, erow *row, const int *at,
+                             int count, int c) {
+  editor_row_modified(buf, row - buf->row, row->size);
+  editor_pos_add(buf, row - buf->row, count);
+  buf->mem_chars -= mem_size(row->chars);
+  row->chars = realloc(row->chars, row->size + count + 1);
+  buf->mem_chars += mem_size(row->chars);
+  // Back to front, each run shifting by the inserts before it
+  int end = row->size + 1, k;
+  for (k = count - 1; k >= 0; k--) {
+    memmove(&row->chars[at[k] + k + 1], &row->chars[at[k]], end - at[k]);
+    row->chars[at[k] + k] = c;
+    end = at[k];
+  }
+  row->size += count;
+  if (buf->batch) {
+    editor_row_drop_render(buf, row);
+  } else {
+    editor_update_row(buf, row);
+  }
+}
+
+// Swaps rows [at, at + count) for all of src's rows, which change hands
+// without their text being copied. src is left empty.
+void editor_replace_rows(ebuffer *buf, int at, int count, ebuffer *src) {
+  assert(at >= 0 && count >= 0 && at + count <= buf->num_rows);
+  int j;
+  if (buf->index) {
+    // Rows are about to move away from their index entries
+    for (j = 0; j < buf->index_rows; j++) {
+      editor_row_settle(buf, j);
+    }
+    editor_release_index(buf);
+  }
+  if (at < buf->disk_rows) {
+    buf->relayout = 1;
+  }
+  for (j = at; j < at + count; j++) {
+    buf->mem_chars -= mem_size(buf->row[j].chars);
+    buf->mem_render -= mem_size(buf->row[j].render);
+    free(buf->row[j].chars);
+    free(buf->row[j].render);
+  }
+
+  int num_rows = buf->num_rows - count + src->num_rows;
+  if (num_rows > buf->row_cap) {
+    buf->row_cap = num_rows > buf->row_cap * 2 ? num_rows : buf->row_cap * 2;
+    buf->row = realloc(buf->row, sizeof(erow) * buf->row_cap);
+  }
+  if (num_rows > 0) {
+    memmove(&buf->row[at + src->num_rows], &buf->row[at + count],
+            sizeof(erow) * (buf->num_rows - at - count));
+    memcpy(&buf->row[at], src->row, sizeof(erow) * src->num_rows);
+  }
+  buf->num_rows = num_rows;
+  buf->mem_chars += src->mem_chars;
+  buf->mem_render += src->mem_render;
+  // Every block from at on may have shifted
+  editor_pos_rebuild(buf);
+
+  src->num_rows = 0;
+  src->mem_chars = 0;
+  src->mem_render = 0;
+  free(src->pos_tree);
+  src->pos_tree = NULL;
+  src->pos_blocks = src->pos_cap = 0;
+}
+
+void editor_free_rows(ebuffer *buf) {
+  int j;
+  for (j = 0; j < buf->num_rows; j++) {
+    free(buf->row[j].chars);
+    free(buf->row[j].render);
+  }
+  buf->num_rows = 0;
+  buf->mem_chars = 0;
+  buf->mem_render = 0;
+  buf->disk_rows = 0;
+  buf->disk_len = 0;
+  buf->num_dirty = 0;
+  buf->relayout = 0;
+  buf->pos_blocks = 0;
+  editor_release_index(buf);
+  editor_map_unguard(buf);
+  if (buf->map) {
+    munmap((void *)buf->map, buf->map_len);
+    buf->map = NULL;
+    buf->map_len = 0;
+  }
+}
+
+// Splits a chunk of file data into rows, continuing an unterminated last row
+void editor_ingest(ebuffer *buf, const char *data, size_t len) {
+  size_t start = 0;
+  while (start < len) {
+    const char *nl = memchr(&data[start], '\n', len - start);
+    size_t end = nl ? (size_t)(nl - data) : len;
+    size_t seg = end;
+    while (nl && seg > start && data[seg - 1] == '\r') {
+      seg--;
+    }
+
+    if (buf->tail_open) {
+      erow *row = editor_row(buf, buf->num_rows - 1);
+      editor_row_append_string(buf, row, &data[start], seg - start);
+      if (nl && row->size > 0 && row->chars[row->size - 1] == '\r') {
+        while (row->size > 0 && row->chars[row->size - 1] == '\r') {
+          row->size--;
+          editor_pos_add(buf, buf->num_rows - 1, -1);
+        }
+        row->chars[row->size] = '\0';
+        editor_update_row(buf, row);
+      }
+    } else {
+      editor_append_row(buf, &data[start], seg - start);
+    }
+    buf->tail_open = nl == NULL;
+    start = end + 1;
+  }
+}
+
+// Writes rows from (*row, *off) up to last to fd in one writev, straight out
+// of each row's chars or the file map, and advances the position past what
+// was taken
+ssize_t editor_write_rows(ebuffer *buf, int fd, int *row, int last,
+                          size_t *off) {
+  struct iovec iov[ROWS_IOV];
+  int n = 0, j = *row;
+  size_t o = *off;
+  while (j <= last && n < ROWS_IOV - 1) {
+    int len;
+    const char *text = editor_row_text(buf, j++, &len);
+    if (o < (size_t)len) {
+      iov[n].iov_base = (void *)&text[o];
+      iov[n++].iov_len = len - o;
+    }
+    iov[n].iov_base = (void *)"\n";
+    iov[n++].iov_len = 1;
+    o = 0;
+  }
+
+  ssize_t written = writev(fd, iov, n);
+  size_t left = written > 0 ? written : 0;
+  while (left > 0) {
+    size_t rest = buf->row[*row].size + 1 - *off;
+    if (left < rest) {
+      *off += left;
+      break;
+    }
+    left -= rest;
+    (*row)++;
+    *off = 0;
+  }
+  return written;
+}
+
+// SAVING//
+
+// Writes every row from first on at fd's offset, returns bytes written or -1
+static long long editor_write_from(ebuffer *buf, int fd, int first) {
+  long long total = 0;
+  int row = first;
+  size_t off = 0;
+  while (row < buf->num_rows) {
+    ssize_t n = editor_write_rows(buf, fd, &row, buf->num_rows - 1, &off);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    total += n;
+  }
+  return total;
+}
+
+// Writes back only what changed while rows kept their place in the file fd
+// is open on: dirty rows go where they were and rows from the first one that
+// moved on are written out as the tail. Returns bytes written, or -1 if the
+// file has to be written out in full, as rows moved, the file changed behind
+// our back or a write failed. A half done patch is fine to write over, the
+// rows it came from are still whole in the map.
+long long editor_save_in_place(ebuffer *buf, int fd) {
+  struct stat st;
+  int first;
+  if (fstat(fd, &st) == -1 || st.st_ino != buf->file_stat.st_ino ||
+      st.st_size != buf->disk_len ||
+      st.st_mtim.tv_sec != buf->file_stat.st_mtim.tv_sec ||
+      st.st_mtim.tv_nsec != buf->file_stat.st_mtim.tv_nsec) {
+    return -1;
+  }
+  long long tail = editor_save_tail(buf, &first);
+  if (tail < 0 || buf->index_bad) {
+    return -1; // The tail's first row may have no place to go to either
+  }
+  long long patched = editor_write_dirty(buf, fd, tail), appended = -1;
+  if (patched >= 0 && lseek(fd, tail, SEEK_SET) == tail) {
+    appended = editor_write_from(buf, fd, first);
+  }
+  if (appended < 0 || ftruncate(fd, tail + appended) == -1) {
+    return -1;
+  }
+  editor_saved_in_place(buf, tail, first);
+  fstat(fd, &buf->file_stat);
+  return patched + appended;
+}
+
+// Rewrites the whole file fd is open on for reading and writing, in place,
+// so symlinks, hard links, owner and mode all stay as they were. Rows not
+// loaded yet would see their bytes in the map change under them as the file
+// is written, so they are read from a private copy of the old contents taken
+// first. Returns bytes written or -1, in which case the rows are still whole
+// in that copy.
+long long editor_save_rewrite(ebuffer *buf, int fd) {
+  if (buf->map) {
+    void *copy = mmap(NULL, buf->map_len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (copy == MAP_FAILED) {
+      return -1;
+    }
+    memcpy(copy, buf->map, buf->map_len);
+    munmap((void *)buf->map, buf->map_len);
+    buf->map = copy;
+  }
+  // The file may have been cut short while it was being copied
+  editor_map_recover(buf);
+
+  long long total = -1;
+  if (lseek(fd, 0, SEEK_SET) == 0) {
+    total = editor_write_from(buf, fd, 0);
+  }
+  if (total < 0 || ftruncate(fd, total) == -1) {
+    return -1;
+  }
+
+  // Rows not loaded yet now live at new offsets in the new contents, or are
+  // loaded from the copy if those can't be mapped
+  void *map = NULL;
+  if (total > 0) {
+    map = mmap(NULL, total, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  if (map == MAP_FAILED) {
+    int j;
+    for (j = 0; j < buf->num_rows; j++) {
+      editor_row(buf, j);
+    }
+    map = NULL;
+  }
+  editor_remap_rows(buf, map, total);
+  fstat(fd, &buf->file_stat);
+  return total;
+}
+
+char *editor_rows_to_string(ebuffer *buf, int *buf_len) {
+  // The position index already knows the total, no need for a sizing pass
+  int tot_len = editor_buffer_bytes(buf);
+  int j, len;
+  *buf_len = tot_len;
+  char *out = malloc(tot_len);
+  char *p = out;
+  for (j = 0; j < buf->num_rows; j++) {
+    const char *text = editor_row_text(buf, j, &len);
+    memcpy(p, text, len);
+    p += len;
+    *p = '\n';
+    p++;
+  }
+  return out;
+}
+
+// POSITION INDEX//
+
+// Bytes in the first count blocks
+static long long editor_pos_prefix(ebuffer *buf, int count) {
+  long long sum = 0;
+  for (; count > 0; count -= count & -count) {
+    sum += buf->pos_tree[count];
+  }
+  return sum;
+}
+
+// Makes room for one more, empty, block. The new node sums the blocks it
+// covers, which except for itself are already in the tree.
+static void editor_pos_grow(ebuffer *buf) {
+  int i = ++buf->pos_blocks;
+  if (i >= buf->pos_cap) {
+    buf->pos_cap = buf->pos_cap ? buf->pos_cap * 2 : 64;
+    buf->pos_tree = realloc(buf->pos_tree, sizeof(long long) * buf->pos_cap);
+  }
+  buf->pos_tree[i] =
+      editor_pos_prefix(buf, i - 1) - editor_pos_prefix(buf, i - (i & -i));
+}
+
+// Row at got delta bytes longer
+void editor_pos_add(ebuffer *buf, int at, long long delta) {
+  int i;
+  for (i = at / POS_BLOCK + 1; i <= buf->pos_blocks; i += i & -i) {
+    buf->pos_tree[i] += delta;
+  }
+}
+
+// Sizes the tree for the buffer's rows and fills it in from block sums in
+// one linear pass
+static void editor_pos_build(ebuffer *buf,
+                             long long (*block)(ebuffer *, int)) {
+  int n = (buf->num_rows + POS_BLOCK - 1) / POS_BLOCK, i;
+  if (n + 1 > buf->pos_cap) {
+    buf->pos_cap = n + 1;
+    buf->pos_tree = realloc(buf->pos_tree, sizeof(long long) * buf->pos_cap);
+  }
+  buf->pos_blocks = n;
+  for (i = 1; i <= n; i++) {
+    buf->pos_tree[i] = block(buf, i - 1);
+  }
+  for (i = 1; i <= n; i++) {
+    int parent = i + (i & -i);
+    if (parent <= n) {
+      buf->pos_tree[parent] += buf->pos_tree[i];
+    }
+  }
+}
+
+static long long editor_pos_block_rows(ebuffer *buf, int b) {
+  long long sum = 0;
+  int j, len;
+  for (j = b * POS_BLOCK; j < buf->num_rows && j < (b + 1) * POS_BLOCK; j++) {
+    editor_row_text(buf, j, &len);
+    sum += len + 1;
+  }
+  return sum;
+}
+
+static long long editor_pos_block_index(ebuffer *buf, int b) {
+  int last = (b + 1) * POS_BLOCK;
+  if (last > buf->num_rows) {
+    last = buf->num_rows;
+  }
+  return buf->index[last] - buf->index[b * POS_BLOCK];
+}
+
+static long long editor_pos_block_cached(ebuffer *buf, int b) {
+  return buf->index_blocks[b];
+}
+
+// Sums every row again, after rows were added or removed in the middle
+void editor_pos_rebuild(ebuffer *buf) {
+  editor_pos_build(buf, editor_pos_block_rows);
+}
+
+// Builds the tree straight from the line index of a file just opened, from
+// the block sums it carries or else the difference of two offsets a block.
+// Rows with CRs are shorter than that, so without sums every row is looked
+// at after all.
+void editor_pos_from_index(ebuffer *buf) {
+  editor_pos_build(buf, buf->index_blocks ? editor_pos_block_cached
+                        : buf->index_crs  ? editor_pos_block_rows
+                                          : editor_pos_block_index);
+}
+
+long long editor_buffer_bytes(ebuffer *buf) {
+  return editor_pos_prefix(buf, buf->pos_blocks);
+}
+
+// Bytes before row at, counting a newline after each row
+long long editor_row_offset(ebuffer *buf, int at) {
+  if (at >= buf->num_rows) {
+    return editor_buffer_bytes(buf);
+  }
+  long long off = editor_pos_prefix(buf, at / POS_BLOCK);
+  int j, len;
+  for (j = at / POS_BLOCK * POS_BLOCK; j < at; j++) {
+    editor_row_text(buf, j, &len);
+    off += len + 1;
+  }
+  return off;
+}
+
+// Row holding byte off and where in it, *col being the row's size if off is
+// its newline. Past the end gives the end of the last row.
+int editor_offset_row(ebuffer *buf, long long off, int *col) {
+  // Walk down the tree to the block off falls in
+  int pos = 0, step = 1;
+  while (step * 2 <= buf->pos_blocks) {
+    step *= 2;
+  }
+  for (; step > 0; step /= 2) {
+    if (pos + step <= buf->pos_blocks && buf->pos_tree[pos + step] <= off) {
+      pos += step;
+      off -= buf->pos_tree[pos];
+    }
+  }
+
+  int j, len;
+  for (j = pos * POS_BLOCK; j < buf->num_rows; j++) {
+    editor_row_text(buf, j, &len);
+    if (off <= len) {
+      *col = off;
+      return j;
+    }
+    off -= len + 1;
+  }
+  *col = 0;
+  if (buf->num_rows == 0) {
+    return 0;
+  }
+  editor_row_text(buf, buf->num_rows - 1, col);
+  return buf->num_rows - 1;
+}
+
+// APPEND BUFFER//
+void abuf_append(append_buffer *abuf, const char *s, int len) {
+  if (len == 0) {
+    // realloc() to 0 bytes may free the buffer, a blank line drawn into a
+    // reused one included
+    return;
+  }
+  char *new = realloc(abuf->b, abuf->len + len);
+  if (new == NULL) {
+    return;
+  }
+  memcpy(&new[abuf->len], s, len);
+  abuf->b = new;
+  abuf->len += len;
+}
+
+void abuf_free(append_buffer *abuf) { free(abuf->b); }
+
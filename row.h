@@ -0,0 +1,116 @@
+// Row storage and the append buffer, kept free of terminal and editor state
+// so they can be driven from the microbenchmarks as well as from Quill
+#ifndef QUILL_ROW_H
+#define QUILL_ROW_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define TAB_STOP 8
+#define POS_BLOCK 1024 // rows summed up by one entry of the position index
+
+// Editor row
+typedef struct EditorRow {
+  int size;     // 4 bytes
+  int rsize;    // 4 bytes
+  char *chars;  // 8 bytes
+  char *render; // 8 bytes
+  long long off; // 8 bytes, where the row starts in the file map, -1 if not
+  int dirty;     // 4 bytes, 1 if changed since the file was read or saved
+} erow;
+
+// A row changed since the file was read or saved, and the bytes it still
+// holds in the file
+typedef struct DirtyRow {
+  int row;
+  int len;
+  long long off;
+} dirty_row;
+
+// Rows of one buffer and what they cost
+typedef struct EditorBuffer {
+  int num_rows;      // 4 bytes
+  int row_cap;       // 4 bytes, allocated slots in row
+  erow *row;         // 8 bytes
+  size_t mem_chars;  // allocator bytes behind every row's chars
+  size_t mem_render; // allocator bytes behind every row's render
+  int batch;     // 1 while edits defer rebuilding render to the next draw
+  int tail_open; // 1 if the last row has not seen its newline yet
+  struct stat file_stat; // the file as last read or saved, so every view of
+  char *index_file;      // it sees a save; where its line index is cached
+  const char *map;     // the file rows without chars are read from, or NULL
+  size_t map_len;
+  volatile sig_atomic_t map_lost; // 1 once the file was cut short under map
+  struct EditorBuffer *guard_next; // next buffer whose map is guarded
+  const uint64_t *index; // start of each of the first index_rows rows, plus
+  int index_rows;        // one past the end, for rows not looked at yet
+  void *index_mem;       // what index lives in, mapped or allocated
+  size_t index_len;
+  int index_mapped;      // 1 if index_mem has to be unmapped, not freed
+  int index_crs;         // 1 if rows in the index may end in CRs
+  const uint64_t *index_blocks; // bytes in each POS_BLOCK rows, CRs dropped
+  int index_bad;         // 1 once an entry was found pointing outside the map
+  int disk_rows;       // rows the file holds, at the start of row
+  long long disk_len;  // bytes the file holds
+  dirty_row *dirty;    // rows below disk_rows changed since, in any order
+  int num_dirty;
+  int dirty_cap;
+  int relayout;        // 1 once rows below disk_rows were added or removed
+  long long *pos_tree; // Fenwick tree over the bytes of each POS_BLOCK rows
+  int pos_blocks;
+  int pos_cap;
+} ebuffer;
+
+// APPEND BUFFER//
+typedef struct AppendBuffer {
+  char *b;
+  int len;
+} append_buffer;
+
+#define ABUF_INIT                                                              \
+  { NULL, 0 }
+
+size_t mem_size(void *p);
+
+erow *editor_row(ebuffer *buf, int at);
+const char *editor_row_text(ebuffer *buf, int at, int *len);
+void editor_release_index(ebuffer *buf);
+void editor_map_guard(ebuffer *buf);
+int editor_map_recover(ebuffer *buf);
+void editor_remap_rows(ebuffer *buf, const char *map, size_t len);
+void editor_row_modified(ebuffer *buf, int at, int disk_len);
+long long editor_save_tail(ebuffer *buf, int *first);
+long long editor_write_dirty(ebuffer *buf, int fd, long long before);
+void editor_saved_in_place(ebuffer *buf, long long tail, int first);
+long long editor_save_in_place(ebuffer *buf, int fd);
+long long editor_save_rewrite(ebuffer *buf, int fd);
+void editor_pos_add(ebuffer *buf, int at, long long delta);
+void editor_pos_rebuild(ebuffer *buf);
+void editor_pos_from_index(ebuffer *buf);
+long long editor_buffer_bytes(ebuffer *buf);
+long long editor_row_offset(ebuffer *buf, int at);
+int editor_offset_row(ebuffer *buf, long long off, int *col);
+ssize_t editor_write_rows(ebuffer *buf, int fd, int *row, int last,
+                          size_t *off);
+int editor_row_conversion(erow *row, int cx);
+int editor_row_rx_to_cx(erow *row, int rx);
+void editor_update_row(ebuffer *buf, erow *row);
+void editor_append_row(ebuffer *buf, const char *s, size_t len);
+void editor_row_drop_render(ebuffer *buf, erow *row);
+void editor_row_insert_char(ebuffer *buf, erow *row, int at, int c);
+void editor_row_insert_chars(ebuffer *buf, erow *row, const int *at,
+                             int count, int c);
+void editor_row_append_string(ebuffer *buf, erow *row, const char *s,
+                              size_t len);
+void editor_replace_rows(ebuffer *buf, int at, int count, ebuffer *src);
+void editor_free_rows(ebuffer *buf);
+void editor_ingest(ebuffer *buf, const char *data, size_t len);
+char *editor_rows_to_string(ebuffer *buf, int *buf_len);
+
+void abuf_append(append_buffer *abuf, const char *s, int len);
+void abuf_free(append_buffer *abuf);
+
+#endif
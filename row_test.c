@@ -0,0 +1,484 @@
+// Tests for the row primitives in row.c, run without a terminal
+//
+//   row_test
+//
+// Buffers are set up the way Quill opens a file: mapped, indexed, and with
+// rows loaded only as they are touched. Prints every failed check and exits
+// nonzero if there was one.
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "row.h"
+
+int checks = 0, failed = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    checks++;                                                                  \
+    if (!(cond)) {                                                             \
+      failed++;                                                                \
+      printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);                  \
+    }                                                                          \
+  } while (0)
+
+// A scratch file holding text, and the buffer mapped from it as
+// editor_open_mapped would leave it
+int open_text(ebuffer *buf, const char *text) {
+  char path[] = "/tmp/row_testXXXXXX";
+  int fd = mkstemp(path);
+  unlink(path);
+  size_t len = strlen(text);
+  if (fd == -1 || write(fd, text, len) != (ssize_t)len) {
+    perror("row_test");
+    exit(1);
+  }
+
+  memset(buf, 0, sizeof(*buf));
+  // Offsets, then the bytes of each POS_BLOCK rows without their CRs
+  uint64_t *index = calloc(len + 2 + len / POS_BLOCK + 1, sizeof(uint64_t));
+  uint64_t *sums = &index[len + 2];
+  size_t p = 0;
+  int rows = 0;
+  while (p < len) {
+    index[rows] = p;
+    const char *nl = memchr(&text[p], '\n', len - p);
+    size_t n = (nl ? (size_t)(nl - text) : len) - p;
+    while (nl && n > 0 && text[p + n - 1] == '\r') {
+      n--;
+      buf->index_crs = 1;
+    }
+    sums[rows++ / POS_BLOCK] += n + 1;
+    p = nl ? (size_t)(nl - text) + 1 : len;
+  }
+  buf->tail_open = len > 0 && text[len - 1] != '\n';
+  index[rows] = len + buf->tail_open;
+  buf->index_blocks = sums;
+
+  if (len > 0) {
+    buf->map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    buf->map_len = len;
+  }
+  editor_map_guard(buf);
+  buf->index = index;
+  buf->index_rows = rows;
+  buf->index_mem = index;
+  buf->row = calloc(rows + 1, sizeof(erow));
+  buf->row_cap = buf->num_rows = buf->disk_rows = rows;
+  buf->disk_len = len;
+  fstat(fd, &buf->file_stat);
+  editor_pos_from_index(buf);
+  return fd;
+}
+
+void close_text(ebuffer *buf, int fd) {
+  editor_free_rows(buf);
+  free(buf->row);
+  free(buf->dirty);
+  free(buf->pos_tree);
+  close(fd);
+}
+
+// The file's contents, NUL terminated
+char *file_text(int fd) {
+  off_t len = lseek(fd, 0, SEEK_END);
+  char *s = malloc(len + 1);
+  s[pread(fd, s, len, 0) == len ? len : 0] = '\0';
+  return s;
+}
+
+int file_is(int fd, const char *want) {
+  char *got = file_text(fd);
+  int same = strcmp(got, want) == 0;
+  if (!same) {
+    printf("     file holds \"%s\", wanted \"%s\"\n", got, want);
+  }
+  free(got);
+  return same;
+}
+
+// Overwrites row at with s of the same length, as replace-all does
+void overwrite_row(ebuffer *buf, int at, const char *s) {
+  erow *row = editor_row(buf, at);
+  editor_row_modified(buf, at, row->size);
+  memcpy(row->chars, s, row->size);
+  editor_update_row(buf, row);
+}
+
+// SAVE PLANNER //
+
+void test_untouched_tail_open(void) {
+  ebuffer buf;
+  int fd = open_text(&buf, "a\nbb\ncc");
+  CHECK(buf.tail_open);
+  int first;
+  CHECK(editor_save_tail(&buf, &first) == 5 && first == 2);
+  CHECK(editor_save_in_place(&buf, fd) >= 0);
+  CHECK(file_is(fd, "a\nbb\ncc\n"));
+  CHECK(!buf.tail_open && buf.disk_len == 8);
+  close_text(&buf, fd);
+}
+
+void test_tail_open_last_row_grows(void) {
+  ebuffer buf;
+  int fd = open_text(&buf, "a\nbb\ncc");
+  editor_row_append_string(&buf, editor_row(&buf, 2), "xyz", 3);
+  overwrite_row(&buf, 0, "A");
+  CHECK(editor_save_in_place(&buf, fd) >= 0);
+  CHECK(file_is(fd, "A\nbb\nccxyz\n"));
+  // A second save has nothing left to write but is still right
+  CHECK(editor_save_in_place(&buf, fd) >= 0);
+  CHECK(file_is(fd, "A\nbb\nccxyz\n"));
+  close_text(&buf, fd);
+}
+
+void test_same_length_rows(void) {
+  ebuffer buf;
+  int fd = open_text(&buf, "one\ntwo\nsix\nten\n");
+  overwrite_row(&buf, 1, "TWO");
+  overwrite_row(&buf, 2, "SIX");
+  overwrite_row(&buf, 1, "tWo"); // Counted once
+  CHECK(buf.num_dirty == 2);
+  int first;
+  CHECK(editor_save_tail(&buf, &first) == 16 && first == 4);
+  CHECK(editor_save_in_place(&buf, fd) >= 0);
+  CHECK(file_is(fd, "one\ntWo\nSIX\nten\n"));
+  CHECK(buf.num_dirty == 0 && !editor_row(&buf, 1)->dirty);
+  close_text(&buf, fd);
+}
+
+// A cached index is only checked as its rows are looked at
+void test_damaged_index(void) {
+  ebuffer buf;
+  int fd = open_text(&buf, "a\nbb\ncc\ndd\n");
+  uint64_t *index = buf.index_mem;
+  index[2] = 1000; // Row 1 would run off the map, row 2 start there
+  int len;
+  editor_row_text(&buf, 0, &len);
+  CHECK(len == 1 && !buf.index_bad);
+  CHECK(editor_row(&buf, 1)->size == 0 && buf.index_bad);
+  editor_row_text(&buf, 2, &len);
+  CHECK(len == 0);
+  const char *text = editor_row_text(&buf, 3, &len);
+  CHECK(len == 2 && memcmp(text, "dd", 2) == 0);
+  close_text(&buf, fd);
+}
+
+void test_crlf_rows(void) {
+  ebuffer buf;
+  int fd = open_text(&buf, "ab\r\ncd\r\nef\r\n");
+  CHECK(buf.index_crs);
+  int len;
+  const char *text = editor_row_text(&buf, 1, &len);
+  CHECK(len == 2 && memcmp(text, "cd", 2) == 0);
+  // The CRs stay in the file where only the text before them is patched
+  overwrite_row(&buf, 1, "CD");
+  CHECK(editor_save_in_place(&buf, fd) >= 0);
+  CHECK(file_is(fd, "ab\r\nCD\r\nef\r\n"));
+  close_text(&buf, fd);
+}
+
+void test_last_row_grows(void) {
+  ebuffer buf;
+  int fd = open_text(&buf, "a\nb\nc\n");
+  editor_row_insert_char(&buf, editor_row(&buf, 2), 0, 'z');
+  int first;
+  CHECK(editor_save_tail(&buf, &first) == 4 && first == 2);
+  CHECK(editor_save_in_place(&buf, fd) >= 0);
+  CHECK(file_is(fd, "a\nb\nzc\n"));
+  close_text(&buf, fd);
+}
+
+void test_rows_appended(void) {
+  ebuffer buf;
+  int fd = open_text(&buf, "a\nb\n");
+  editor_append_row(&buf, "new", 3);
+  int first;
+  CHECK(editor_save_tail(&buf, &first) == 4 && first == 2);
+  CHECK(editor_save_in_place(&buf, fd) >= 0);
+  CHECK(file_is(fd, "a\nb\nnew\n"));
+  CHECK(buf.disk_rows == 3 && buf.disk_len == 8);
+  close_text(&buf, fd);
+}
+
+void test_middle_row_grows(void) {
+  ebuffer buf;
+  int fd = open_text(&buf, "a\nb\nc\n");
+  editor_row_insert_char(&buf, editor_row(&buf, 1), 1, 'z');
+  int first;
+  CHECK(editor_save_tail(&buf, &first) == -1);
+  CHECK(editor_save_rewrite(&buf, fd) >= 0);
+  CHECK(file_is(fd, "a\nbz\nc\n"));
+  close_text(&buf, fd);
+}
+
+void test_relayout_fallback(void) {
+  ebuffer buf, src;
+  int fd = open_text(&buf, "a\nb\nc\nd\n");
+  memset(&src, 0, sizeof(src));
+  editor_append_row(&src, "x", 1);
+  editor_append_row(&src, "y", 1);
+  editor_append_row(&src, "z", 1);
+  editor_replace_rows(&buf, 1, 2, &src); // b and c become x, y and z
+  free(src.row);
+  CHECK(buf.relayout);
+  int first;
+  CHECK(editor_save_tail(&buf, &first) == -1);
+  CHECK(editor_save_in_place(&buf, fd) == -1);
+  CHECK(editor_save_rewrite(&buf, fd) >= 0);
+  CHECK(file_is(fd, "a\nx\ny\nz\nd\n"));
+  // Once written out the rows have places again
+  CHECK(!buf.relayout && buf.disk_rows == 5 && buf.disk_len == 10);
+  overwrite_row(&buf, 3, "Z");
+  CHECK(editor_save_in_place(&buf, fd) >= 0);
+  CHECK(file_is(fd, "a\nx\ny\nZ\nd\n"));
+  close_text(&buf, fd);
+}
+
+void test_changed_on_disk(void) {
+  ebuffer buf;
+  int fd = open_text(&buf, "one\ntwo\n");
+  overwrite_row(&buf, 0, "ONE");
+  // Touched by someone else, so the rows' places can't be trusted
+  struct timespec when[2] = {{0, UTIME_OMIT}, {12345, 0}};
+  CHECK(futimens(fd, when) == 0);
+  CHECK(editor_save_in_place(&buf, fd) == -1);
+  CHECK(editor_save_rewrite(&buf, fd) >= 0);
+  CHECK(file_is(fd, "ONE\ntwo\n"));
+  overwrite_row(&buf, 1, "TWO");
+  CHECK(editor_save_in_place(&buf, fd) == 3); // Just the row, not its newline
+  // Grown behind our back
+  CHECK(pwrite(fd, "six\n", 4, 8) == 4);
+  overwrite_row(&buf, 1, "two");
+  CHECK(editor_save_in_place(&buf, fd) == -1);
+  CHECK(editor_save_rewrite(&buf, fd) == 8);
+  CHECK(file_is(fd, "ONE\ntwo\n"));
+  close_text(&buf, fd);
+}
+
+// POSITION INDEX //
+
+// Bytes before row at, one row at a time
+long long naive_offset(ebuffer *buf, int at) {
+  long long off = 0;
+  int j, len;
+  for (j = 0; j < at && j < buf->num_rows; j++) {
+    editor_row_text(buf, j, &len);
+    off += len + 1;
+  }
+  return off;
+}
+
+// Checks the tree against naive sums at every row, and offsets that go
+// back to rows at every block edge and past the end
+int pos_matches(ebuffer *buf) {
+  long long off = 0, total = naive_offset(buf, buf->num_rows);
+  int j, len, col, ok = editor_buffer_bytes(buf) == total;
+  for (j = 0; j < buf->num_rows && ok; j++) {
+    ok = editor_row_offset(buf, j) == off;
+    editor_row_text(buf, j, &len);
+    if (j % POS_BLOCK == 0 || j == buf->num_rows - 1) {
+      ok = ok && editor_offset_row(buf, off, &col) == j && col == 0;
+      ok = ok && editor_offset_row(buf, off + len, &col) == j && col == len;
+    }
+    off += len + 1;
+  }
+  if (ok && buf->num_rows > 0) {
+    editor_row_text(buf, buf->num_rows - 1, &len);
+    ok = editor_offset_row(buf, total + 100, &col) == buf->num_rows - 1 &&
+         col == len;
+  }
+  return ok;
+}
+
+// Rows of 0 to 40 bytes, some ending in CRs
+char *make_lines(int rows, int crs) {
+  char *s = malloc(rows * 43 + 1), *p = s;
+  int j;
+  for (j = 0; j < rows; j++) {
+    int len = rand() % 41;
+    memset(p, 'a' + j % 26, len);
+    p += len;
+    if (crs && j % 3 == 0) {
+      *p++ = '\r';
+    }
+    *p++ = '\n';
+  }
+  *p = '\0';
+  return s;
+}
+
+void test_pos_from_index(void) {
+  int crs;
+  for (crs = 0; crs <= 1; crs++) {
+    ebuffer buf;
+    char *text = make_lines(POS_BLOCK * 3 + 17, crs);
+    int fd = open_text(&buf, text);
+    CHECK(buf.index_crs == crs);
+    CHECK(pos_matches(&buf));
+    free(text);
+    close_text(&buf, fd);
+  }
+}
+
+void test_pos_after_edits(void) {
+  ebuffer buf, src;
+  char *text = make_lines(POS_BLOCK * 4, 0);
+  int fd = open_text(&buf, text);
+  free(text);
+  int step;
+  for (step = 0; step < 200; step++) {
+    int at = rand() % (buf.num_rows + 1);
+    int count = rand() % (POS_BLOCK * 2);
+    switch (rand() % 4) {
+    case 0:
+      if (at < buf.num_rows) {
+        editor_row_insert_char(&buf, editor_row(&buf, at), 0, 'x');
+      }
+      break;
+    case 1:
+      if (at < buf.num_rows) {
+        editor_row_append_string(&buf, editor_row(&buf, at), "yyyy", 4);
+      }
+      break;
+    case 2:
+      editor_append_row(&buf, "tail", 4);
+      break;
+    case 3:
+      // Swap up to count rows for up to count others
+      memset(&src, 0, sizeof(src));
+      while (src.num_rows < count / 2) {
+        editor_append_row(&src, "zz", rand() % 3);
+      }
+      if (count > buf.num_rows - at) {
+        count = buf.num_rows - at;
+      }
+      editor_replace_rows(&buf, at, count, &src);
+      free(src.row);
+      break;
+    }
+    if (step % 20 == 0 || step == 199) {
+      CHECK(pos_matches(&buf));
+    }
+  }
+  close_text(&buf, fd);
+}
+
+// BATCHED INSERTS //
+
+// Inserts c at each of the count positions one at a time, right to left so
+// every position still means the same place in the original row
+void naive_inserts(ebuffer *buf, int at, const int *pos, int count, int c) {
+  int k;
+  for (k = count - 1; k >= 0; k--) {
+    editor_row_insert_char(buf, editor_row(buf, at), pos[k], c);
+  }
+}
+
+// Runs the same inserts batched and one at a time on two copies of text,
+// then compares the rows and what they are rendered as
+int inserts_match(const char *text, int at, const int *pos, int count) {
+  ebuffer one, many;
+  int fd_one = open_text(&one, text), fd_many = open_text(&many, text);
+  long long bytes = editor_buffer_bytes(&many);
+  naive_inserts(&one, at, pos, count, '\t');
+  editor_row_insert_chars(&many, editor_row(&many, at), pos, count, '\t');
+  erow *a = editor_row(&one, at), *b = editor_row(&many, at);
+  int ok = a->size == b->size && memcmp(a->chars, b->chars, a->size) == 0 &&
+           b->chars[b->size] == '\0' && a->rsize == b->rsize &&
+           memcmp(a->render, b->render, a->rsize) == 0;
+  ok = ok && editor_buffer_bytes(&many) == bytes + count && pos_matches(&many);
+  // Dirty once, with what the row held in the file
+  ok = ok && many.num_dirty == 1 && many.dirty[0].row == at &&
+       many.dirty[0].len == a->size - count;
+  close_text(&one, fd_one);
+  close_text(&many, fd_many);
+  return ok;
+}
+
+void test_insert_chars(void) {
+  const char *text = "abcdef\n\nx\tyz\nlast\n";
+  int edges[] = {0, 0, 3, 6, 6};
+  CHECK(inserts_match(text, 0, edges, 5));
+  int ends[] = {6, 6, 6};
+  CHECK(inserts_match(text, 0, ends, 3));
+  int empty[] = {0, 0, 0};
+  CHECK(inserts_match(text, 1, empty, 3));
+  int tabbed[] = {1, 2, 4};
+  CHECK(inserts_match(text, 2, tabbed, 3));
+  int one[] = {2};
+  CHECK(inserts_match(text, 3, one, 1));
+}
+
+void test_insert_chars_batched(void) {
+  ebuffer buf;
+  int fd = open_text(&buf, "abc\ndef\n");
+  int pos[] = {0, 1, 3};
+  buf.batch = 1;
+  editor_row_insert_chars(&buf, editor_row(&buf, 0), pos, 3, '-');
+  erow *row = editor_row(&buf, 0);
+  // Render is left to be rebuilt when the row is drawn
+  CHECK(row->render == NULL && strcmp(row->chars, "-a-bc-") == 0);
+  buf.batch = 0;
+  CHECK(editor_save_rewrite(&buf, fd) >= 0);
+  CHECK(file_is(fd, "-a-bc-\ndef\n"));
+  close_text(&buf, fd);
+}
+
+// MAP GUARD //
+
+void test_file_cut_short(void) {
+  ebuffer buf;
+  char *text = make_lines(POS_BLOCK * 3, 0); // Pages and pages of it
+  int fd = open_text(&buf, text);
+  free(text);
+  int loaded = editor_row(&buf, 0)->size, len, j;
+  editor_row_append_string(&buf, editor_row(&buf, 1), "kept", 4);
+  CHECK(ftruncate(fd, 0) == 0);
+
+  // Reading past the new end finds zeros instead of dying
+  const char *in_map = editor_row_text(&buf, POS_BLOCK * 2, &len);
+  int zeros = 0;
+  for (j = 0; j < len; j++) {
+    zeros += in_map[j] == '\0';
+  }
+  CHECK(zeros == len && buf.map_lost);
+  CHECK(editor_row(&buf, POS_BLOCK)->size == 0);
+
+  CHECK(editor_map_recover(&buf) && !buf.map_lost && buf.map == NULL);
+  CHECK(!editor_map_recover(&buf));
+  erow *row = editor_row(&buf, 1);
+  CHECK(editor_row(&buf, 0)->size == loaded);
+  CHECK(row->size >= 4 && memcmp(&row->chars[row->size - 4], "kept", 4) == 0);
+  CHECK(editor_row(&buf, 2)->size == 0 && buf.num_rows == POS_BLOCK * 3);
+  CHECK(pos_matches(&buf));
+  int first;
+  CHECK(editor_save_tail(&buf, &first) == -1);
+  close_text(&buf, fd);
+}
+
+int main(void) {
+  test_untouched_tail_open();
+  test_tail_open_last_row_grows();
+  test_same_length_rows();
+  test_damaged_index();
+  test_crlf_rows();
+  test_last_row_grows();
+  test_rows_appended();
+  test_middle_row_grows();
+  test_relayout_fallback();
+  test_changed_on_disk();
+  test_pos_from_index();
+  test_pos_after_edits();
+  test_insert_chars();
+  test_insert_chars_batched();
+  test_file_cut_short();
+
+  printf("%d checks, %d failed\n", checks, failed);
+  return failed == 0 ? 0 : 1;
+}
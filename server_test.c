@@ -0,0 +1,269 @@
+// Drives a Quill server with two clients over its socket, the way quill -c
+// would, without a terminal
+//
+//   server_test [quill]
+//
+// The server runs with XDG_RUNTIME_DIR and XDG_CACHE_HOME in a fresh
+// directory of its own. Prints every failed check and exits nonzero if there
+// was one, or if the server died along the way.
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define QUIET_MS 300 // a client is caught up once the server is this quiet
+
+int checks = 0, failed = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    checks++;                                                                  \
+    if (!(cond)) {                                                             \
+      failed++;                                                                \
+      printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);                  \
+    }                                                                          \
+  } while (0)
+
+typedef struct Client {
+  int fd;
+  char seen[1 << 16]; // what the server sent since the last drain, clipped
+  size_t len;
+  int hung_up;
+} client;
+
+char dir[] = "/tmp/quill_testXXXXXX";
+struct sockaddr_un addr;
+pid_t server;
+client *a, *b; // the two clients sharing the file
+
+int server_alive(void) { return waitpid(server, NULL, WNOHANG) == 0; }
+
+// Ends a run that can't go on, the server having died or never come up
+int give_up(const char *why) {
+  printf("FAIL %s\n", why);
+  kill(server, SIGKILL);
+  free(a);
+  free(b);
+  printf("%d checks, %d failed\n", checks, failed + 1);
+  return 1;
+}
+
+// Connects and greets the server like quill -c from a terminal cols wide,
+// NULL if nobody answers
+client *attach_cols(const char *path, int cols) {
+  client *c = calloc(1, sizeof(client));
+  c->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    close(c->fd);
+    free(c);
+    return NULL;
+  }
+  dprintf(c->fd, "10 %d 0 %s\n", cols, path);
+  return c;
+}
+
+client *attach(const char *path) { return attach_cols(path, 100); }
+
+// Reads what the server sends until it goes quiet or hangs up
+void drain(client *c) {
+  struct pollfd pfd = {c->fd, POLLIN, 0};
+  c->len = 0;
+  while (!c->hung_up && poll(&pfd, 1, QUIET_MS) > 0) {
+    char buf[4096];
+    ssize_t n = read(c->fd, buf, sizeof(buf));
+    if (n <= 0) {
+      c->hung_up = 1;
+      break;
+    }
+    size_t room = sizeof(c->seen) - 1 - c->len;
+    n = (size_t)n < room ? (size_t)n : room;
+    memcpy(&c->seen[c->len], buf, n);
+    c->len += n;
+  }
+  c->seen[c->len] = '\0';
+}
+
+void send_keys(client *c, const char *keys) {
+  if (write(c->fd, keys, strlen(keys)) != (ssize_t)strlen(keys)) {
+    c->hung_up = 1;
+  }
+}
+
+int file_is(const char *path, const char *want) {
+  char got[256];
+  FILE *fp = fopen(path, "r");
+  size_t n = fp ? fread(got, 1, sizeof(got) - 1, fp) : 0;
+  got[n] = '\0';
+  if (fp) {
+    fclose(fp);
+  }
+  if (strcmp(got, want) != 0) {
+    printf("     file holds \"%s\", wanted \"%s\"\n", got, want);
+    return 0;
+  }
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  const char *quill = argc > 1 ? argv[1] : "./quill";
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  setenv("XDG_RUNTIME_DIR", dir, 1);
+  setenv("XDG_CACHE_HOME", dir, 1);
+  signal(SIGPIPE, SIG_IGN);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/quill.sock", dir);
+  char path[128];
+  snprintf(path, sizeof(path), "%s/shared.txt", dir);
+  FILE *fp = fopen(path, "w");
+  fputs("hello world\nsecond line\n", fp);
+  fclose(fp);
+
+  server = fork();
+  if (server == 0) {
+    execl(quill, quill, "--server", (char *)NULL);
+    perror(quill);
+    _exit(127);
+  }
+  int tries;
+  for (tries = 0; tries < 50 && a == NULL && server_alive(); tries++) {
+    usleep(100000);
+    a = attach(path);
+  }
+  if (a == NULL) {
+    return give_up("no server listening");
+  }
+
+  struct stat st;
+  CHECK(stat(addr.sun_path, &st) == 0 && (st.st_mode & 077) == 0);
+
+  // Anything but a regular file is turned away, and the server stays up
+  char fifo[128];
+  snprintf(fifo, sizeof(fifo), "%s/fifo", dir);
+  CHECK(mkfifo(fifo, 0600) == 0);
+  const char *odd[] = {dir, fifo, "/nonexistent"};
+  int j;
+  for (j = 0; j < 3; j++) {
+    client *c = attach(odd[j]);
+    CHECK(c != NULL);
+    if (c) {
+      drain(c);
+      CHECK(c->hung_up && strstr(c->seen, "can't open") != NULL);
+      close(c->fd);
+      free(c);
+    }
+  }
+  if (!server_alive()) {
+    return give_up("server died opening something that isn't a file");
+  }
+
+  // Both clients see the file, and each other's typing
+  drain(a);
+  CHECK(strstr(a->seen, "hello world") != NULL);
+  b = attach(path);
+  if (b == NULL) {
+    return give_up("second client can't attach");
+  }
+  drain(b);
+  CHECK(strstr(b->seen, "hello world") != NULL);
+  CHECK(strstr(b->seen, "1 other client") != NULL);
+
+  // Too narrow for the whole status bar, the file name gives way to where
+  // the cursor is
+  client *narrow = attach_cols(path, 24);
+  if (narrow) {
+    drain(narrow);
+    CHECK(strstr(narrow->seen, "@0 0% 1/2") != NULL);
+    close(narrow->fd);
+    free(narrow);
+  }
+  drain(a);
+  drain(b);
+  send_keys(a, "AB");
+  drain(a);
+  drain(b);
+  CHECK(strstr(b->seen, "ABhello world") != NULL);
+
+  // B's cursor sits past where A's filter cuts every row off
+  send_keys(b, "lllllllllllll");
+  drain(b);
+  send_keys(a, "\x10%!cut -c1-2\r");
+  drain(a);
+  drain(b);
+  CHECK(server_alive());
+  CHECK(!b->hung_up && strstr(b->seen, "se") != NULL);
+  send_keys(b, "X");
+  drain(b);
+  CHECK(strstr(b->seen, "ABX") != NULL);
+
+  // A failing filter leaves the rows alone
+  send_keys(a, "\x10%!false\r");
+  drain(a);
+  CHECK(strstr(a->seen, "Filter failed") != NULL);
+
+  // B saves what both typed, A detaches and the server stays up for B
+  send_keys(b, "\x13");
+  drain(b);
+  CHECK(file_is(path, "ABX\nse\n"));
+
+  // A save by one client is known to the other, so neither falls back to
+  // rewriting the whole file
+  send_keys(a, "\x12se\rSE\r\x13");
+  drain(a);
+  CHECK(strstr(a->seen, "written in place") != NULL);
+  send_keys(b, "\x12" "AB\rab\r\x13");
+  drain(b);
+  CHECK(strstr(b->seen, "written in place") != NULL);
+  CHECK(file_is(path, "abX\nSE\n"));
+  send_keys(a, "\x11");
+  drain(a);
+  CHECK(a->hung_up);
+  send_keys(b, "Y");
+  drain(b);
+  CHECK(server_alive() && strstr(b->seen, "abXY") != NULL);
+
+  // Replacing with nothing deletes the matches, a literal in place in the
+  // row and a regex into a new one
+  send_keys(b, "\x12Y\r\r\x12/S|b/\r\r\x13");
+  drain(b);
+  CHECK(file_is(path, "aX\nE\n"));
+
+  // Only Escape on its own clears the extra cursors, not a key sequence
+  // nobody knows
+  send_keys(b, "kkkhhh\x0e\x1b[Z");
+  drain(b);
+  send_keys(b, "Q\x13");
+  drain(b);
+  CHECK(file_is(path, "QaX\nQE\n"));
+  send_keys(b, "\x1b");
+  drain(b);
+  send_keys(b, "R\x13");
+  drain(b);
+  CHECK(file_is(path, "QaX\nQRE\n"));
+
+  kill(server, SIGTERM);
+  waitpid(server, NULL, 0);
+  close(a->fd);
+  close(b->fd);
+  free(a);
+  free(b);
+  char cmd[64];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+  if (system(cmd) != 0) {
+    fprintf(stderr, "server_test: couldn't remove %s\n", dir);
+  }
+
+  printf("%d checks, %d failed\n", checks, failed);
+  return failed == 0 ? 0 : 1;
+}